@@ -0,0 +1,137 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "memory.h"
+
+// Bump allocator for fixed-size nodes, addressed by a 32-bit index.
+// Slots are handed out uninitialised from chunks of kChunkSize nodes;
+// nothing is freed individually, and clear() releases whole chunks, so
+// teardown costs O(number of chunks) rather than O(number of nodes).
+// adopt() instead points the chunk table at nodes stored elsewhere, e.g.
+// a mapped image, which the arena then neither frees nor grows.
+//
+// Indexing may run concurrently with one allocate() at a time: a full
+// chunk table is replaced by a copy twice its size rather than grown in
+// place, and old tables are kept until clear(), so a reader holding one
+// still finds every node it knew of. Chunks never move.
+template <typename T>
+class NodeArena {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "NodeArena never runs destructors");
+
+public:
+    static constexpr std::size_t kChunkShift = 10;
+    static constexpr std::size_t kChunkSize = std::size_t(1) << kChunkShift;
+
+    NodeArena() = default;
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+    ~NodeArena() { clear(); }
+
+    // Reserve count consecutive slots and return the index of the first
+    std::uint32_t allocate(std::size_t count = 1) {
+        if (external_) {
+            throw std::logic_error("NodeArena: cannot allocate in adopted storage");
+        }
+        std::size_t first = size_;
+        std::size_t need = (size_ + count + kChunkSize - 1) / kChunkSize;
+        reserve_table(need);
+        T** table = table_.load(std::memory_order_relaxed);
+        for (; num_chunks_ < need; ++num_chunks_) {
+            table[num_chunks_] = static_cast<T*>(::operator new(
+                kChunkSize * sizeof(T), std::align_val_t(alignof(T))));
+        }
+        size_ += count;
+        return static_cast<std::uint32_t>(first);
+    }
+
+    T& operator[](std::size_t id) {
+        return table_.load(std::memory_order_acquire)[id >> kChunkShift][id & (kChunkSize - 1)];
+    }
+    const T& operator[](std::size_t id) const {
+        return table_.load(std::memory_order_acquire)[id >> kChunkShift][id & (kChunkSize - 1)];
+    }
+
+    // Serve count nodes stored contiguously at base (aligned for T), which
+    // must outlive the arena or the next clear()
+    void adopt(T* base, std::size_t count) {
+        clear();
+        reserve_table((count + kChunkSize - 1) / kChunkSize);
+        T** table = table_.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < count; i += kChunkSize) {
+            table[num_chunks_++] = base + i;
+        }
+        size_ = count;
+        external_ = true;
+    }
+
+    void clear() {
+        T** table = table_.load(std::memory_order_relaxed);
+        if (!external_) {
+            for (std::size_t i = 0; i < num_chunks_; ++i) {
+                ::operator delete(table[i], std::align_val_t(alignof(T)));
+            }
+        }
+        tables_.clear();
+        table_.store(nullptr, std::memory_order_relaxed);
+        table_capacity_ = 0;
+        num_chunks_ = 0;
+        size_ = 0;
+        external_ = false;
+    }
+
+    std::size_t size() const { return size_; }
+    std::size_t num_chunks() const { return num_chunks_; }
+
+    bool external() const { return external_; }
+
+    // Heap bytes held: every chunk plus the chunk tables, old ones
+    // included (only the tables for adopted storage)
+    std::size_t heap_bytes() const {
+        std::size_t bytes = vector_heap_bytes(tables_);
+        for (const Table& t : tables_) {
+            bytes += heap_block_bytes(t.chunks.get(), t.capacity * sizeof(T*));
+        }
+        if (external_) return bytes;
+        T** table = table_.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < num_chunks_; ++i) {
+            bytes += heap_block_bytes(table[i], kChunkSize * sizeof(T));
+        }
+        return bytes;
+    }
+
+private:
+    struct Table {
+        std::unique_ptr<T*[]> chunks;
+        std::size_t capacity;
+    };
+
+    std::atomic<T**> table_{nullptr};   // current chunk table
+    std::vector<Table> tables_;         // every table so far, current last
+    std::size_t table_capacity_ = 0;
+    std::size_t num_chunks_ = 0;
+    std::size_t size_ = 0;
+    bool external_ = false;
+
+    // Make the table hold at least need chunks, publishing a larger copy
+    // if it is full
+    void reserve_table(std::size_t need) {
+        if (need <= table_capacity_) return;
+        std::size_t cap = std::max<std::size_t>(table_capacity_ * 2, 16);
+        while (cap < need) cap *= 2;
+        std::unique_ptr<T*[]> table(new T*[cap]);
+        T** old = table_.load(std::memory_order_relaxed);
+        std::copy(old, old + num_chunks_, table.get());
+        table_.store(table.get(), std::memory_order_release);
+        tables_.push_back({std::move(table), cap});
+        table_capacity_ = cap;
+    }
+};
@@ -1,130 +1,755 @@
 #include "bpt.h"
+#include "simd_search.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
 
-BPTree::BPTree(std::size_t order) : order_(order), root_(nullptr) {}
+namespace {
 
-BPTree::~BPTree() {
-    free_node(root_);
+// 一个节点的key区 (8条cache line)
+inline void prefetch_keys(const BPTreeNode* node) {
+    const char* p = reinterpret_cast<const char*>(node->keys);
+    for (std::size_t off = 0; off < sizeof(node->keys); off += 64) {
+        __builtin_prefetch(p + off);
+    }
 }
 
-void BPTree::free_node(BPTreeNode* node) {
-    if (!node) return;
-    if (!node->is_leaf) {
-        for (BPTreeNode* ch : node->child_ptrs) {
-            free_node(ch);
-        }
+// 整个节点 (key区 + value区)
+inline void prefetch_node(const BPTreeNode* node) {
+    const char* p = reinterpret_cast<const char*>(node);
+    for (std::size_t off = 0; off < sizeof(BPTreeNode); off += 64) {
+        __builtin_prefetch(p + off);
     }
-    delete node;
 }
 
-std::size_t BPTree::count_nodes(BPTreeNode* node) const {
-    if (!node) return 0;
-    std::size_t cnt = 1;
-    if (!node->is_leaf) {
-        for (BPTreeNode* ch : node->child_ptrs) {
-            cnt += count_nodes(ch);
-        }
+// 镜像文件: header之后的元数据, 节点区按页对齐
+struct BPTreeImageMeta {
+    std::uint64_t order;
+    std::uint64_t num_nodes;
+    std::uint64_t nodes_offset;
+    std::uint32_t root;
+    std::uint32_t node_bytes;   // sizeof(BPTreeNode), 布局校验
+};
+
+constexpr std::size_t kImagePageBytes = 4096;
+
+// 插入/删除时记录的最大路径长度
+constexpr std::size_t kMaxDepth = 64;
+
+// 一次结构修改最多持有的写锁: 每层本节点/兄弟/新节点/前驱叶子
+constexpr std::size_t kMaxLatches = 4 * kMaxDepth + 4;
+
+// 乐观锁 (BPTreeNode::version): 读者不加锁, 前后两次读版本, 变了就重来
+constexpr std::uint64_t kFreed = 1;
+constexpr std::uint64_t kLocked = 2;
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// 等到没有写者再读版本; 节点已释放则返回false (读者需要重启)
+inline bool read_lock(const BPTreeNode& node, std::uint64_t& v) {
+    v = __atomic_load_n(&node.version, __ATOMIC_ACQUIRE);
+    while (v & kLocked) {
+        cpu_relax();
+        v = __atomic_load_n(&node.version, __ATOMIC_ACQUIRE);
+    }
+    return !(v & kFreed);
+}
+
+// 版本没变 <=> 这期间读到的内容有效
+inline bool validate(const BPTreeNode& node, std::uint64_t v) {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return __atomic_load_n(&node.version, __ATOMIC_RELAXED) == v;
+}
+
+// 从读到的版本v直接上写锁; 期间被改过则失败
+inline bool upgrade(BPTreeNode& node, std::uint64_t v) {
+    return __atomic_compare_exchange_n(&node.version, &v, v + kLocked, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// 等待并上写锁. 只有结构修改会等; 和它争锁的单叶子写者只持有一把锁且从不等待
+inline void write_lock(BPTreeNode& node) {
+    for (;;) {
+        std::uint64_t v = __atomic_load_n(&node.version, __ATOMIC_RELAXED);
+        if (!(v & kLocked) && upgrade(node, v)) return;
+        cpu_relax();
+    }
+}
+
+// 解锁并递增计数; freed则同时标记为已释放
+inline void write_unlock(BPTreeNode& node, bool freed = false) {
+    __atomic_store_n(&node.version, node.version + kLocked + (freed ? kFreed : 0),
+                     __ATOMIC_RELEASE);
+}
+
+// 从节点中删除slot处的条目
+inline void remove_slot(BPTreeNode& node, std::size_t slot) {
+    std::copy(node.keys + slot + 1, node.keys + node.num_keys, node.keys + slot);
+    std::copy(node.vals + slot + 1, node.vals + node.num_keys, node.vals + slot);
+    --node.num_keys;
+}
+
+} // namespace
+
+struct BPTree::Latches {
+    explicit Latches(NodeArena<BPTreeNode>& arena) : nodes(arena) {}
+    Latches(const Latches&) = delete;
+    Latches& operator=(const Latches&) = delete;
+    ~Latches() {
+        for (std::size_t i = 0; i < n; ++i) write_unlock(nodes[ids[i]], freed[i]);
+    }
+
+    bool held(std::uint32_t id) const {
+        return std::find(ids, ids + n, id) != ids + n;
+    }
+
+    // 加锁 (已持有则跳过)
+    void lock(std::uint32_t id) {
+        if (held(id)) return;
+        write_lock(nodes[id]);
+        add(id);
+    }
+
+    // 已经上锁的节点 (new_node) 交给这里统一解锁
+    void add(std::uint32_t id) {
+        if (n == kMaxLatches) throw std::runtime_error("BPTree: too many latches");
+        ids[n] = id;
+        freed[n] = false;
+        ++n;
+    }
+
+    void mark_freed(std::uint32_t id) {
+        lock(id);
+        freed[std::find(ids, ids + n, id) - ids] = true;
+    }
+
+    NodeArena<BPTreeNode>& nodes;
+    std::uint32_t ids[kMaxLatches];
+    bool freed[kMaxLatches];
+    std::size_t n = 0;
+};
+
+BPTree::BPTree(std::size_t order, double fill_factor)
+    : order_(order), fill_factor_(fill_factor), root_(kBPTreeNoNode) {
+    // order 2 时满的内部节点分裂后左半只剩1个孩子, 每次插入都可能加高一层
+    if (order < 3 || order > kBPTreeMaxOrder) {
+        throw std::invalid_argument("BPTree: order must be in [3, 64]");
+    }
+    if (!(fill_factor > 0.0 && fill_factor <= 1.0)) {
+        throw std::invalid_argument("BPTree: fill_factor must be in (0, 1]");
     }
-    return cnt;
 }
 
-void BPTree::bulk_load(const std::vector<std::uint64_t>& keys) {
-    // 清空旧树
-    free_node(root_);
-    root_ = nullptr;
+void BPTree::bulk_load(KeySpan keys) {
+    // 清空旧树 (先清arena, 再释放它可能引用的镜像)
+    nodes_.clear();
+    image_.reset();
+    free_nodes_.clear();
+    root_ = kBPTreeNoNode;
 
     std::size_t n = keys.size();
     if (n == 0) return;
 
+    // 每个节点装 per 个条目, 其余留给之后的插入 (内部节点至少2个孩子)
+    std::size_t per = static_cast<std::size_t>(static_cast<double>(order_) * fill_factor_);
+    per = std::min(order_, std::max<std::size_t>(per, 2));
+
+    // 先算出每层节点数, 从arena按顺序分配 (不做零初始化)
+    std::size_t total = 0;
+    for (std::size_t cnt = (n + per - 1) / per; ; cnt = (cnt + per - 1) / per) {
+        total += cnt;
+        if (cnt == 1) break;
+    }
+    if (total >= kBPTreeNoNode) {
+        throw std::runtime_error("BPTree::bulk_load: too many nodes");
+    }
+    nodes_.allocate(total);
+
     // 构建叶子层
-    std::vector<BPTreeNode*> leaves;
-    std::size_t i = 0;
-    while (i < n) {
-        BPTreeNode* leaf = new BPTreeNode(true, order_);
-        std::size_t end = std::min(i + order_, n);
-        leaf->keys.reserve(end - i);
-        leaf->children.reserve(end - i);
+    std::size_t num_leaves = 0;
+    for (std::size_t i = 0; i < n; i += per) {
+        BPTreeNode& leaf = nodes_[num_leaves];
+        std::size_t end = std::min(i + per, n);
+        leaf.num_keys = static_cast<std::uint32_t>(end - i);
+        leaf.is_leaf = 1;
+        leaf.version = 0;
         for (std::size_t j = i; j < end; ++j) {
-            leaf->keys.push_back(keys[j]);
-            leaf->children.push_back(j); // 保存原始位置
+            leaf.keys[j - i] = keys[j];
+            leaf.vals[j - i] = j; // 保存原始位置
         }
-        leaf->min_key = leaf->keys.front();  // 叶子子树最小key
-        leaves.push_back(leaf);
-        i = end;
+        ++num_leaves;
+        leaf.next = (end < n) ? static_cast<std::uint32_t>(num_leaves) : kBPTreeNoNode;
     }
 
-    for (std::size_t j = 0; j + 1 < leaves.size(); ++j) {
-        leaves[j]->next = leaves[j + 1];
+    // 自底向上构建内部节点, 每层紧接在下一层之后
+    std::size_t level_begin = 0, level_end = num_leaves;
+    while (level_end - level_begin > 1) {
+        std::size_t out = level_end;
+        for (std::size_t idx = level_begin; idx < level_end; idx += per) {
+            BPTreeNode& parent = nodes_[out++];
+            std::size_t group_end = std::min(idx + per, level_end);
+            parent.num_keys = static_cast<std::uint32_t>(group_end - idx);
+            parent.is_leaf = 0;
+            parent.next = kBPTreeNoNode;
+            parent.version = 0;
+            for (std::size_t k = idx; k < group_end; ++k) {
+                parent.keys[k - idx] = nodes_[k].keys[0]; // 子树最小key
+                parent.vals[k - idx] = k;
+            }
+        }
+        level_begin = level_end;
+        level_end = out;
     }
 
-    // 自底向上构建内部节点
-    std::vector<BPTreeNode*> level = leaves;
-    while (level.size() > 1) {
-        std::vector<BPTreeNode*> new_level;
-        std::size_t idx = 0;
-        while (idx < level.size()) {
-            BPTreeNode* parent = new BPTreeNode(false, order_);
-            std::size_t group_end = std::min(idx + order_, level.size());
-            parent->child_ptrs.reserve(group_end - idx);
+    root_ = static_cast<std::uint32_t>(level_begin);
+}
 
-            for (std::size_t k = idx; k < group_end; ++k) {
-                parent->child_ptrs.push_back(level[k]);
+std::size_t BPTree::descend(std::uint64_t key, std::uint32_t* path,
+                            std::uint32_t* slots) const {
+    std::size_t depth = 0;
+    path[0] = root_;
+    while (!nodes_[path[depth]].is_leaf) {
+        if (depth + 1 >= kMaxDepth) {
+            throw std::runtime_error("BPTree: tree too deep");
+        }
+        const BPTreeNode& node = nodes_[path[depth]];
+        std::size_t cnt = count_le(node.keys, node.num_keys, key);
+        std::size_t slot = cnt > 0 ? cnt - 1 : 0;
+        slots[depth] = static_cast<std::uint32_t>(slot);
+        path[++depth] = static_cast<std::uint32_t>(node.vals[slot]);
+    }
+    return depth;
+}
+
+std::uint32_t BPTree::new_node(Latches& latches) {
+    std::uint32_t id;
+    if (!free_nodes_.empty()) {
+        // 优先复用删除时释放的节点. 版本+1: 清掉释放位并上写锁,
+        // 还停在这个节点里的旧读者校验时会失败
+        id = free_nodes_.back();
+        free_nodes_.pop_back();
+        BPTreeNode& node = nodes_[id];
+        __atomic_store_n(&node.version, node.version + 1, __ATOMIC_RELAXED);
+    } else {
+        if (nodes_.size() + 1 >= kBPTreeNoNode) {
+            throw std::runtime_error("BPTree::insert: too many nodes");
+        }
+        id = nodes_.allocate(1);
+        __atomic_store_n(&nodes_[id].version, kLocked, __ATOMIC_RELAXED);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    latches.add(id);
+    return id;
+}
+
+void BPTree::free_node(std::uint32_t id, Latches& latches) {
+    latches.mark_freed(id);
+    nodes_[id].num_keys = 0;
+    free_nodes_.push_back(id);
+}
+
+void BPTree::check_writable(const char* what) const {
+    if (image_) {
+        throw std::logic_error(std::string("BPTree::") + what + ": tree is a read-only image");
+    }
+}
+
+void BPTree::update_min(const std::uint32_t* path, const std::uint32_t* slots,
+                        std::size_t level, Latches& latches) {
+    for (; level > 0; --level) {
+        std::uint64_t min = nodes_[path[level]].keys[0];
+        std::uint64_t& sep = nodes_[path[level - 1]].keys[slots[level - 1]];
+        // 没变则更上层也不会变, 不必给父节点加锁
+        if (sep == min) break;
+        latches.lock(path[level - 1]);
+        sep = min;
+        if (slots[level - 1] != 0) break;
+    }
+}
+
+std::uint32_t BPTree::insert_entry(std::uint32_t id, std::size_t at,
+                                   std::uint64_t key, std::uint64_t val, Latches& latches) {
+    BPTreeNode& node = nodes_[id];
+    std::size_t n = node.num_keys;
+    if (n < order_) {
+        std::copy_backward(node.keys + at, node.keys + n, node.keys + n + 1);
+        std::copy_backward(node.vals + at, node.vals + n, node.vals + n + 1);
+        node.keys[at] = key;
+        node.vals[at] = val;
+        node.num_keys = static_cast<std::uint32_t>(n + 1);
+        return kBPTreeNoNode;
+    }
+
+    // 满了: order_+1 个条目对半分, 右半部分放进新节点
+    std::uint64_t keys[kBPTreeMaxOrder + 1];
+    std::uint64_t vals[kBPTreeMaxOrder + 1];
+    std::copy(node.keys, node.keys + at, keys);
+    std::copy(node.vals, node.vals + at, vals);
+    keys[at] = key;
+    vals[at] = val;
+    std::copy(node.keys + at, node.keys + n, keys + at + 1);
+    std::copy(node.vals + at, node.vals + n, vals + at + 1);
+
+    std::uint32_t right_id = new_node(latches);
+    BPTreeNode& right = nodes_[right_id];   // arena的chunk不会移动, node仍然有效
+    std::size_t left_n = (n + 1) / 2;
+    std::size_t right_n = n + 1 - left_n;
+    std::copy(keys, keys + left_n, node.keys);
+    std::copy(vals, vals + left_n, node.vals);
+    std::copy(keys + left_n, keys + n + 1, right.keys);
+    std::copy(vals + left_n, vals + n + 1, right.vals);
+    node.num_keys = static_cast<std::uint32_t>(left_n);
+    right.num_keys = static_cast<std::uint32_t>(right_n);
+    right.is_leaf = node.is_leaf;
+    if (node.is_leaf) {
+        right.next = node.next;
+        node.next = right_id;
+    } else {
+        right.next = kBPTreeNoNode;
+    }
+    return right_id;
+}
+
+bool BPTree::insert(std::uint64_t key, std::size_t value) {
+    check_writable("insert");
+    bool added;
+    if (try_insert_leaf(key, value, added)) return added;
+    return insert_smo(key, value);
+}
+
+bool BPTree::try_insert_leaf(std::uint64_t key, std::size_t value, bool& added) {
+    for (;;) {
+        std::uint32_t id;
+        std::uint64_t v;
+        std::size_t depth;
+        if (!optimistic_leaf(key, id, v, depth)) continue;
+        if (id == kBPTreeNoNode) return false;
+        BPTreeNode& leaf = nodes_[id];
+        if (!upgrade(leaf, v)) continue;
+
+        // 叶子从读到版本v起没变过, 仍然覆盖key
+        std::size_t n = leaf.num_keys;
+        std::size_t cnt = count_le(leaf.keys, n, key);
+        bool done = true;
+        if (cnt > 0 && leaf.keys[cnt - 1] == key) {
+            leaf.vals[cnt - 1] = value;
+            added = false;
+        } else if (n < order_ && (cnt > 0 || depth == 0)) {
+            // 不分裂, 也不改变父节点里的最小key
+            std::copy_backward(leaf.keys + cnt, leaf.keys + n, leaf.keys + n + 1);
+            std::copy_backward(leaf.vals + cnt, leaf.vals + n, leaf.vals + n + 1);
+            leaf.keys[cnt] = key;
+            leaf.vals[cnt] = value;
+            leaf.num_keys = static_cast<std::uint32_t>(n + 1);
+            added = true;
+        } else {
+            done = false;
+        }
+        write_unlock(leaf);
+        return done;
+    }
+}
+
+bool BPTree::insert_smo(std::uint64_t key, std::size_t value) {
+    std::lock_guard<std::mutex> smo(smo_mutex_);
+    Latches latches(nodes_);
+    if (root_ == kBPTreeNoNode) {
+        std::uint32_t id = new_node(latches);
+        BPTreeNode& leaf = nodes_[id];
+        leaf.keys[0] = key;
+        leaf.vals[0] = value;
+        leaf.num_keys = 1;
+        leaf.is_leaf = 1;
+        leaf.next = kBPTreeNoNode;
+        root_ = id;
+        return true;
+    }
+
+    // 内部节点只有结构修改会改, 持有smo_mutex_时不会变;
+    // 叶子可能正被单叶子写者修改, 先加锁再读
+    std::uint32_t path[kMaxDepth], slots[kMaxDepth];
+    std::size_t depth = descend(key, path, slots);
+    latches.lock(path[depth]);
+    BPTreeNode& leaf = nodes_[path[depth]];
+    std::size_t cnt = count_le(leaf.keys, leaf.num_keys, key);
+    if (cnt > 0 && leaf.keys[cnt - 1] == key) {
+        leaf.vals[cnt - 1] = value;
+        return false;
+    }
+
+    // 自底向上: 节点分裂时把新的右兄弟插入父节点
+    std::uint64_t k = key, v = value;
+    std::size_t at = cnt;
+    for (std::size_t level = depth; ; --level) {
+        std::uint32_t right = insert_entry(path[level], at, k, v, latches);
+        if (right == kBPTreeNoNode) {
+            update_min(path, slots, level, latches);
+            return true;
+        }
+        if (level == 0) {
+            // 根分裂: 树长高一层. 旧根解锁前换好root_, 读者读完根的版本后会再确认
+            std::uint32_t id = new_node(latches);
+            BPTreeNode& root = nodes_[id];
+            root.keys[0] = nodes_[root_].keys[0];
+            root.vals[0] = root_;
+            root.keys[1] = nodes_[right].keys[0];
+            root.vals[1] = right;
+            root.num_keys = 2;
+            root.is_leaf = 0;
+            root.next = kBPTreeNoNode;
+            root_ = id;
+            return true;
+        }
+        latches.lock(path[level - 1]);
+        nodes_[path[level - 1]].keys[slots[level - 1]] = nodes_[path[level]].keys[0];
+        at = slots[level - 1] + 1;
+        k = nodes_[right].keys[0];
+        v = right;
+    }
+}
+
+bool BPTree::erase(std::uint64_t key) {
+    check_writable("erase");
+    bool erased;
+    if (try_erase_leaf(key, erased)) return erased;
+    return erase_smo(key);
+}
+
+bool BPTree::try_erase_leaf(std::uint64_t key, bool& erased) {
+    for (;;) {
+        std::uint32_t id;
+        std::uint64_t v;
+        std::size_t depth;
+        if (!optimistic_leaf(key, id, v, depth)) continue;
+        if (id == kBPTreeNoNode) {
+            erased = false;
+            return true;
+        }
+        BPTreeNode& leaf = nodes_[id];
+        if (!upgrade(leaf, v)) continue;
+
+        std::size_t n = leaf.num_keys;
+        std::size_t cnt = count_le(leaf.keys, n, key);
+        bool done = true;
+        if (cnt == 0 || leaf.keys[cnt - 1] != key) {
+            erased = false;
+        } else if (depth == 0 ? n > 1 : cnt > 1 && n - 1 >= min_entries()) {
+            // 不会不足半满, 也不删最小key
+            remove_slot(leaf, cnt - 1);
+            erased = true;
+        } else {
+            done = false;
+        }
+        write_unlock(leaf);
+        return done;
+    }
+}
+
+bool BPTree::erase_smo(std::uint64_t key) {
+    std::lock_guard<std::mutex> smo(smo_mutex_);
+    Latches latches(nodes_);
+    if (root_ == kBPTreeNoNode) return false;
+
+    std::uint32_t path[kMaxDepth], slots[kMaxDepth];
+    std::size_t depth = descend(key, path, slots);
+    latches.lock(path[depth]);
+    BPTreeNode& leaf = nodes_[path[depth]];
+    std::size_t cnt = count_le(leaf.keys, leaf.num_keys, key);
+    if (cnt == 0 || leaf.keys[cnt - 1] != key) return false;
+    remove_slot(leaf, cnt - 1);
+
+    // 自底向上修复不足半满的节点
+    for (std::size_t level = depth; ; --level) {
+        BPTreeNode& node = nodes_[path[level]];
+        if (level == 0) {
+            // 根: 空了则树为空, 只剩一个孩子则由孩子做根
+            while (root_ != kBPTreeNoNode) {
+                std::uint32_t old = root_;
+                latches.lock(old);
+                BPTreeNode& root = nodes_[old];
+                if (root.num_keys == 0) {
+                    root_ = kBPTreeNoNode;
+                } else if (!root.is_leaf && root.num_keys == 1) {
+                    root_ = static_cast<std::uint32_t>(root.vals[0]);
+                } else {
+                    break;
+                }
+                free_node(old, latches);
             }
-            parent->min_key = parent->child_ptrs.front()->min_key;
+            return true;
+        }
+        if (node.num_keys >= min_entries()) {
+            update_min(path, slots, level, latches);
+            return true;
+        }
 
-            // 分割key
-            for (std::size_t child_idx = 1; child_idx < parent->child_ptrs.size(); ++child_idx) {
-                parent->keys.push_back(parent->child_ptrs[child_idx]->min_key);
+        latches.lock(path[level - 1]);
+        BPTreeNode& parent = nodes_[path[level - 1]];
+        std::size_t slot = slots[level - 1];
+        if (parent.num_keys == 1) {
+            // 没有兄弟 (只出现在很小的order或批量构建的最后一个节点)
+            if (node.num_keys > 0) {
+                update_min(path, slots, level, latches);
+                return true;
             }
+            // 空节点: 从父节点摘掉; 叶子还要让前一个叶子跳过它
+            if (node.is_leaf) {
+                std::size_t up = level - 1;
+                while (up > 0 && slots[up] == 0) --up;
+                if (slots[up] > 0) {
+                    std::uint32_t prev = static_cast<std::uint32_t>(
+                        nodes_[path[up]].vals[slots[up] - 1]);
+                    while (!nodes_[prev].is_leaf) {
+                        const BPTreeNode& p = nodes_[prev];
+                        prev = static_cast<std::uint32_t>(p.vals[p.num_keys - 1]);
+                    }
+                    latches.lock(prev);
+                    nodes_[prev].next = node.next;
+                }
+            }
+            remove_slot(parent, 0);
+            free_node(path[level], latches);
+            continue;
+        }
 
-            new_level.push_back(parent);
-            idx = group_end;
+        // 与相邻兄弟配对: (左, 右) = (ls, ls + 1)
+        std::size_t ls = slot > 0 ? slot - 1 : slot;
+        std::uint32_t left_id = static_cast<std::uint32_t>(parent.vals[ls]);
+        std::uint32_t right_id = static_cast<std::uint32_t>(parent.vals[ls + 1]);
+        latches.lock(left_id);
+        latches.lock(right_id);
+        BPTreeNode& left = nodes_[left_id];
+        BPTreeNode& right = nodes_[right_id];
+        const BPTreeNode& sibling = left_id == path[level] ? right : left;
+        std::size_t total = left.num_keys + right.num_keys;
+
+        if (sibling.num_keys > min_entries()) {
+            // 兄弟有富余: 两个节点平分条目
+            std::size_t left_n = total / 2;
+            if (left.num_keys < left_n) {
+                std::size_t m = left_n - left.num_keys;
+                std::copy(right.keys, right.keys + m, left.keys + left.num_keys);
+                std::copy(right.vals, right.vals + m, left.vals + left.num_keys);
+                std::copy(right.keys + m, right.keys + right.num_keys, right.keys);
+                std::copy(right.vals + m, right.vals + right.num_keys, right.vals);
+            } else {
+                std::size_t m = left.num_keys - left_n;
+                std::copy_backward(right.keys, right.keys + right.num_keys,
+                                   right.keys + right.num_keys + m);
+                std::copy_backward(right.vals, right.vals + right.num_keys,
+                                   right.vals + right.num_keys + m);
+                std::copy(left.keys + left_n, left.keys + left.num_keys, right.keys);
+                std::copy(left.vals + left_n, left.vals + left.num_keys, right.vals);
+            }
+            left.num_keys = static_cast<std::uint32_t>(left_n);
+            right.num_keys = static_cast<std::uint32_t>(total - left_n);
+            parent.keys[ls] = left.keys[0];
+            parent.keys[ls + 1] = right.keys[0];
+            update_min(path, slots, level - 1, latches);
+            return true;
         }
-        level = std::move(new_level);
+
+        // 合并: 右节点并入左节点, 父节点少一个条目, 继续向上检查
+        std::copy(right.keys, right.keys + right.num_keys, left.keys + left.num_keys);
+        std::copy(right.vals, right.vals + right.num_keys, left.vals + left.num_keys);
+        left.num_keys = static_cast<std::uint32_t>(total);
+        if (left.is_leaf) left.next = right.next;
+        remove_slot(parent, ls + 1);
+        parent.keys[ls] = left.keys[0];
+        free_node(right_id, latches);
     }
+}
 
-    root_ = level[0];
+void BPTree::save(const std::string& path) const {
+    ImageWriter out(path, ImageKind::BPTree);
+    BPTreeImageMeta meta{};
+    meta.order = order_;
+    meta.num_nodes = nodes_.size();
+    meta.root = root_;
+    meta.node_bytes = sizeof(BPTreeNode);
+    std::size_t meta_end = sizeof(ImageHeader) + sizeof(meta);
+    meta.nodes_offset = (meta_end + kImagePageBytes - 1) / kImagePageBytes * kImagePageBytes;
+    out.write(&meta, sizeof(meta));
+    out.align(kImagePageBytes);
+
+    // 只写有效部分, 其余清零: 同一棵树总是得到同样的字节
+    BPTreeNode node;
+    for (std::size_t i = 0; i < nodes_.size(); ++i) {
+        const BPTreeNode& src = nodes_[i];
+        std::memset(&node, 0, sizeof(node));
+        std::copy(src.keys, src.keys + src.num_keys, node.keys);
+        std::copy(src.vals, src.vals + src.num_keys, node.vals);
+        node.num_keys = src.num_keys;
+        node.is_leaf = src.is_leaf;
+        node.next = src.next;
+        out.write(&node, sizeof(node));
+    }
+    out.finish();
 }
 
-bool BPTree::search(std::uint64_t key, std::size_t& pos) const {
-    BPTreeNode* node = root_;
-    if (!node) return false;
+void BPTree::open(const std::string& path, bool verify) {
+    auto image = std::make_unique<MappedImage>(path, ImageKind::BPTree, verify);
+    const BPTreeImageMeta& meta = *image->at<BPTreeImageMeta>(sizeof(ImageHeader), 1);
+    bool root_ok = meta.num_nodes == 0 ? meta.root == kBPTreeNoNode
+                                       : meta.root < meta.num_nodes;
+    if (meta.node_bytes != sizeof(BPTreeNode) || meta.order < 3 ||
+        meta.order > kBPTreeMaxOrder || meta.num_nodes >= kBPTreeNoNode || !root_ok) {
+        throw std::runtime_error("BPTree::open: bad tree metadata in " + path);
+    }
+    const BPTreeNode* nodes = image->at<BPTreeNode>(meta.nodes_offset, meta.num_nodes);
 
-    // 从root向下
+    // 映射是只读的: 之后只允许查询
+    nodes_.adopt(const_cast<BPTreeNode*>(nodes), meta.num_nodes);
+    image_ = std::move(image);
+    order_ = meta.order;
+    root_ = meta.root;
+}
+
+const BPTreeNode* BPTree::leaf_for(std::uint64_t key) const {
+    const BPTreeNode* node = &nodes_[root_];
+
+    // 从root向下: 子节点i覆盖 [keys[i], keys[i+1]), 取 (<=key 的个数) - 1
     while (!node->is_leaf) {
-        const auto& keys = node->keys;
-        std::size_t lo = 0, hi = keys.size();
-        while (lo < hi) {
-            std::size_t mid = (lo + hi) / 2;
-            if (key < keys[mid]) hi = mid;
-            else lo = mid + 1;
-        }
-        std::size_t child_idx = lo;
-        if (child_idx >= node->child_ptrs.size())
-            child_idx = node->child_ptrs.size() - 1;
-        node = node->child_ptrs[child_idx];
-    }
-
-    // binary search
-    const auto& keys_leaf = node->keys;
-    const auto& pos_leaf  = node->children;
-    std::size_t lo = 0, hi = keys_leaf.size();
-    while (lo < hi) {
-        std::size_t mid = (lo + hi) / 2;
-        if (key < keys_leaf[mid]) {
-            hi = mid;
-        } else if (key > keys_leaf[mid]) {
-            lo = mid + 1;
-        } else {
-            pos = pos_leaf[mid];
-            return true;
+        std::size_t cnt = count_le(node->keys, node->num_keys, key);
+        node = &nodes_[node->vals[cnt > 0 ? cnt - 1 : 0]];
+    }
+    return node;
+}
+
+bool BPTree::optimistic_leaf(std::uint64_t key, std::uint32_t& leaf, std::uint64_t& version,
+                             std::size_t& depth) const {
+    std::uint32_t id = root_.load(std::memory_order_acquire);
+    leaf = id;
+    depth = 0;
+    if (id == kBPTreeNoNode) return true;
+
+    // 根可能刚被换掉: 读到根的版本之后再确认一次root_
+    const BPTreeNode* node = &nodes_[id];
+    std::uint64_t v;
+    if (!read_lock(*node, v) || root_.load(std::memory_order_acquire) != id) return false;
+
+    // 节点可能正被修改, 读到的num_keys/孩子下标只有校验通过才可信
+    while (!node->is_leaf) {
+        if (++depth >= kMaxDepth) {
+            // 路径一直校验通过: 是树本身太深, 重试也没用
+            if (!validate(*node, v)) return false;
+            throw std::runtime_error("BPTree: tree too deep");
         }
+        std::size_t n = std::min<std::size_t>(node->num_keys, kBPTreeMaxOrder);
+        std::size_t cnt = count_le(node->keys, n, key);
+        std::uint64_t child = node->vals[cnt > 0 ? cnt - 1 : 0];
+        // 先确认孩子下标有效再访问; 读到孩子的版本后再确认父节点没变
+        if (!validate(*node, v)) return false;
+        const BPTreeNode* next = &nodes_[child];
+        std::uint64_t next_v;
+        if (!read_lock(*next, next_v) || !validate(*node, v)) return false;
+        id = static_cast<std::uint32_t>(child);
+        node = next;
+        v = next_v;
+    }
+    leaf = id;
+    version = v;
+    return true;
+}
+
+bool BPTree::search(std::uint64_t key, std::size_t& pos) const {
+    for (;;) {
+        std::uint32_t id;
+        std::uint64_t v;
+        std::size_t depth;
+        if (!optimistic_leaf(key, id, v, depth)) continue;
+        if (id == kBPTreeNoNode) return false;
+
+        // 叶子: 最后一个 <=key 的位置是否等于key
+        const BPTreeNode& leaf = nodes_[id];
+        std::size_t n = std::min<std::size_t>(leaf.num_keys, kBPTreeMaxOrder);
+        std::size_t cnt = count_le(leaf.keys, n, key);
+        bool hit = cnt > 0 && leaf.keys[cnt - 1] == key;
+        std::size_t p = hit ? leaf.vals[cnt - 1] : 0;
+        if (!validate(leaf, v)) continue;
+        if (hit) pos = p;
+        return hit;
+    }
+}
+
+void BPTree::search_batch(KeySpan queries, Span<std::size_t> out,
+                          Span<bool> found) const {
+    constexpr std::size_t kGroup = 16;
+    std::size_t n = queries.size();
+    if (root_ == kBPTreeNoNode) {
+        for (std::size_t i = 0; i < n; ++i) found[i] = false;
+        return;
     }
-    return false;
+
+    const BPTreeNode* cur[kGroup];
+    for (std::size_t base = 0; base < n; base += kGroup) {
+        std::size_t g = std::min(kGroup, n - base);
+        const std::uint64_t* q = queries.data() + base;
+        for (std::size_t i = 0; i < g; ++i) cur[i] = &nodes_[root_];
+
+        // 所有叶子深度相同: 整组一起下降一层, 同时预取下一层节点
+        while (!cur[0]->is_leaf) {
+            for (std::size_t i = 0; i < g; ++i) {
+                std::size_t cnt = count_le(cur[i]->keys, cur[i]->num_keys, q[i]);
+                cur[i] = &nodes_[cur[i]->vals[cnt > 0 ? cnt - 1 : 0]];
+                prefetch_keys(cur[i]);
+            }
+        }
+
+        for (std::size_t i = 0; i < g; ++i) {
+            std::size_t cnt = count_le(cur[i]->keys, cur[i]->num_keys, q[i]);
+            bool hit = cnt > 0 && cur[i]->keys[cnt - 1] == q[i];
+            found[base + i] = hit;
+            if (hit) out[base + i] = cur[i]->vals[cnt - 1];
+        }
+    }
+}
+
+BPTree::Iterator::Iterator(const BPTree* tree, const BPTreeNode* node,
+                           std::uint32_t slot)
+    : tree_(tree), node_(node), slot_(slot) {
+    if (node_ && node_->next != kBPTreeNoNode) {
+        prefetch_node(&tree_->nodes_[node_->next]);
+    }
+    if (node_ && slot_ == node_->num_keys) next_leaf();
+}
+
+void BPTree::Iterator::next_leaf() {
+    slot_ = 0;
+    if (node_->next == kBPTreeNoNode) {
+        node_ = nullptr;
+        return;
+    }
+    node_ = &tree_->nodes_[node_->next];
+    // 顺序扫描: 提前把下一个叶子取进cache
+    if (node_->next != kBPTreeNoNode) {
+        prefetch_node(&tree_->nodes_[node_->next]);
+    }
+}
+
+BPTree::Iterator BPTree::lower_bound(std::uint64_t key) const {
+    if (root_ == kBPTreeNoNode) return Iterator(this, nullptr, 0);
+    // 用 key-1 下降: 重复key可能从前一个叶子开始
+    if (key == 0) return Iterator(this, leaf_for(0), 0);
+    const BPTreeNode* leaf = leaf_for(key - 1);
+    std::size_t slot = count_le(leaf->keys, leaf->num_keys, key - 1);
+    return Iterator(this, leaf, static_cast<std::uint32_t>(slot));
+}
+
+BPTree::Iterator BPTree::upper_bound(std::uint64_t key) const {
+    if (key == ~std::uint64_t(0)) return Iterator(this, nullptr, 0);
+    return lower_bound(key + 1);
 }
 
-std::size_t BPTree::memory_usage_bytes() const {
-    std::size_t nodes = count_nodes(root_);
-    return nodes * 512;
+MemoryUsage BPTree::memory_usage() const {
+    MemoryUsage m;
+    m.index_bytes = sizeof(*this) + nodes_.heap_bytes() + vector_heap_bytes(free_nodes_);
+    if (image_) m.index_bytes += image_->size();
+    return m;
 }
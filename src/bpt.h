@@ -2,36 +2,193 @@
 #include <vector>
 #include <cstddef>
 #include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
 
-struct BPTreeNode {
-    bool is_leaf;
-    std::size_t order;
+#include "arena.h"
+#include "image.h"
+#include "memory.h"
+#include "span.h"
 
-    std::uint64_t min_key;
+// Maximum fan-out of a node; BPTree's order must not exceed it.
+constexpr std::size_t kBPTreeMaxOrder = 64;
+constexpr std::uint32_t kBPTreeNoNode = 0xFFFFFFFFu;
 
-    std::vector<std::uint64_t> keys;
-    std::vector<std::size_t> children;
-    std::vector<BPTreeNode*> child_ptrs;
+// Packed node: fixed-capacity inline arrays, no heap buffers of its own.
+// Keys come first so they start on a cache line; the whole node is a
+// whole number of cache lines.
+//   inner: keys[i] = smallest key under child i, vals[i] = child node index
+//   leaf:  keys[i] = key,                        vals[i] = original position
+struct alignas(64) BPTreeNode {
+    std::uint64_t keys[kBPTreeMaxOrder];
+    std::uint64_t vals[kBPTreeMaxOrder];
 
-    BPTreeNode* next;
+    std::uint32_t num_keys;
+    std::uint32_t is_leaf;
+    std::uint32_t next;      // index of the next leaf, kBPTreeNoNode at the end
 
-    explicit BPTreeNode(bool leaf, std::size_t ord)
-        : is_leaf(leaf), order(ord), min_key(0), next(nullptr) {}
+    // Optimistic lock: bit 0 = freed, bit 1 = write-locked, the rest
+    // counts writes; 0 in a saved image. Sits in what was tail padding,
+    // so the node size is unchanged.
+    std::uint64_t version;
 };
 
+// search(), insert() and erase() may be called from any number of
+// threads at once, using optimistic lock coupling: readers take no locks,
+// they read each node's version before and after using it and restart
+// from the root if it changed. A writer locks only the nodes it modifies.
+// Writes that stay within one leaf (no split, no underflow, smallest key
+// unchanged) lock just that leaf and run in parallel; the rest (structure
+// modifications) take one at a time. Nodes are never unmapped while the
+// tree lives, so a reader in a node that was just freed only restarts.
+// Everything else (bulk_load, open, save, search_batch, iterators) must
+// not overlap a write.
 class BPTree {
 public:
-    explicit BPTree(std::size_t order = 64);
-    ~BPTree();
+    // Forward iterator over (key, position) in key order. Walks the leaf
+    // chain and prefetches the next leaf whenever it enters a new one.
+    class Iterator {
+    public:
+        bool valid() const { return node_ != nullptr; }
+        std::uint64_t key() const { return node_->keys[slot_]; }
+        std::size_t value() const { return node_->vals[slot_]; }
 
-    void bulk_load(const std::vector<std::uint64_t>& keys);
+        Iterator& operator++() {
+            if (++slot_ == node_->num_keys) next_leaf();
+            return *this;
+        }
+
+    private:
+        friend class BPTree;
+        Iterator(const BPTree* tree, const BPTreeNode* node, std::uint32_t slot);
+        void next_leaf();
+
+        const BPTree* tree_;
+        const BPTreeNode* node_;  // nullptr once past the last key
+        std::uint32_t slot_;
+    };
+
+    // fill_factor in (0, 1]: share of each node's order_ slots that
+    // bulk_load() fills, leaving room for later inserts. Throws
+    // std::invalid_argument if order or fill_factor is out of range.
+    explicit BPTree(std::size_t order = 64, double fill_factor = 1.0);
+
+    void bulk_load(KeySpan keys);
+
+    // Add key with value, splitting full nodes on the way up. If key is
+    // already present its value is overwritten and false is returned.
+    bool insert(std::uint64_t key, std::size_t value);
+
+    // Remove one entry equal to key; returns false if there is none.
+    // Nodes that fall below half full borrow from or merge with a sibling.
+    bool erase(std::uint64_t key);
+
+    // insert() and erase() throw std::logic_error on a tree opened from an
+    // image, whose nodes are read-only.
+
+    // Write the tree to a versioned, checksummed image at path; throws
+    // std::runtime_error on I/O failure
+    void save(const std::string& path) const;
+
+    // Replace the tree with the image at path. Nodes are used in place
+    // from a read-only mapping, so opening costs O(number of chunks) plus,
+    // with verify, one checksum pass over the file. Throws
+    // std::runtime_error if the image is missing, corrupt or not a tree.
+    void open(const std::string& path, bool verify = true);
+    bool is_mapped() const { return image_ != nullptr; }
     bool search(std::uint64_t key, std::size_t& pos) const;
-    std::size_t memory_usage_bytes() const;
+
+    // Look up queries[i] for every i, writing out[i]/found[i] as search()
+    // would. Queries are processed in groups that descend the tree level
+    // by level together, prefetching each group's next nodes so their
+    // cache misses overlap. out and found must be at least queries.size().
+    void search_batch(KeySpan queries, Span<std::size_t> out, Span<bool> found) const;
+
+    // First entry with key >= key / key > key; invalid if there is none
+    Iterator lower_bound(std::uint64_t key) const;
+    Iterator upper_bound(std::uint64_t key) const;
+
+    // Call cb(key, position) for every key in [lo, hi), in key order;
+    // returns the number of keys visited
+    template <typename Callback>
+    std::size_t scan(std::uint64_t lo, std::uint64_t hi, Callback cb) const {
+        std::size_t cnt = 0;
+        for (Iterator it = lower_bound(lo); it.valid() && it.key() < hi; ++it) {
+            cb(it.key(), it.value());
+            ++cnt;
+        }
+        return cnt;
+    }
+
+    // Exact bytes held by the tree, a mapped image included. Leaves carry
+    // their own copy of the keys, so data_bytes is 0: the input array is
+    // not needed after bulk_load.
+    MemoryUsage memory_usage() const;
 
 private:
     std::size_t order_;
-    BPTreeNode* root_;
+    double fill_factor_;
+
+    // All nodes, addressed by index. bulk_load() lays them out level by
+    // level, leaves first and root last; nodes split off by insert() are
+    // appended and nodes freed by erase() are reused. The arena owns the
+    // storage, so destroying the tree frees whole chunks.
+    NodeArena<BPTreeNode> nodes_;
+    std::atomic<std::uint32_t> root_;
+    std::vector<std::uint32_t> free_nodes_;
+
+    // Serialises structure modifications; the nodes' version locks keep
+    // them from readers and from single-leaf writers
+    std::mutex smo_mutex_;
+
+    // Backing storage of the nodes after open(); the arena adopts them
+    std::unique_ptr<MappedImage> image_;
+
+    // Write locks held by one structure modification, released together
+    struct Latches;
+
+    // Leaf whose range covers key: descend to the last child whose
+    // smallest key is <= key
+    const BPTreeNode* leaf_for(std::uint64_t key) const;
+
+    // leaf_for() with lock coupling: leaf and its version, depth 0 if the
+    // leaf is the root, leaf = kBPTreeNoNode for an empty tree. Returns
+    // false if a node changed under the descent and it must restart;
+    // throws std::runtime_error, as descend() does, if the tree is too deep.
+    bool optimistic_leaf(std::uint64_t key, std::uint32_t& leaf, std::uint64_t& version,
+                         std::size_t& depth) const;
+
+    // Single-leaf fast paths: true if done, false if the write needs a
+    // structure modification (or the leaf changed) instead
+    bool try_insert_leaf(std::uint64_t key, std::size_t value, bool& added);
+    bool try_erase_leaf(std::uint64_t key, bool& erased);
+
+    // insert() and erase() as structure modifications, under smo_mutex_
+    bool insert_smo(std::uint64_t key, std::size_t value);
+    bool erase_smo(std::uint64_t key);
+
+    // Non-root nodes are kept at least this full (ceil(order / 2))
+    std::size_t min_entries() const { return (order_ + 1) / 2; }
+
+    // Descend to key's leaf, recording path[0] = root .. path[depth] = leaf
+    // and the child slot taken at each inner node; returns depth
+    std::size_t descend(std::uint64_t key, std::uint32_t* path, std::uint32_t* slots) const;
+
+    // A node write-locked in latches; freed ones are unlocked as freed
+    std::uint32_t new_node(Latches& latches);
+    void free_node(std::uint32_t id, Latches& latches);
+    void check_writable(const char* what) const;
+
+    // Put (key, val) at slot at of node id, which the caller has locked; a
+    // full node is split in half and the new right sibling returned,
+    // kBPTreeNoNode otherwise
+    std::uint32_t insert_entry(std::uint32_t id, std::size_t at,
+                               std::uint64_t key, std::uint64_t val, Latches& latches);
 
-    void free_node(BPTreeNode* node);
-    std::size_t count_nodes(BPTreeNode* node) const;
+    // Copy path[level]'s smallest key into its parent, and on up while the
+    // node is its parent's first child and the key changed
+    void update_min(const std::uint32_t* path, const std::uint32_t* slots, std::size_t level,
+                    Latches& latches);
 };
@@ -0,0 +1,156 @@
+#include "dataset.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define DATASET_HAVE_MMAP 1
+#endif
+
+namespace {
+
+constexpr std::size_t kHeaderBytes = sizeof(std::uint64_t);
+
+bool ends_with(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::size_t key_bytes_for(const std::string& path, KeyWidth width) {
+    if (width == KeyWidth::U32) return 4;
+    if (width == KeyWidth::U64) return 8;
+    return ends_with(path, "uint32") ? 4 : 8;
+}
+
+// Widen uint32 keys from raw file bytes into out
+void widen_u32(const unsigned char* src, std::size_t count,
+               std::vector<std::uint64_t>& out) {
+    out.resize(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        std::uint32_t k;
+        std::memcpy(&k, src + i * sizeof(k), sizeof(k));
+        out[i] = k;
+    }
+}
+
+} // namespace
+
+Dataset::Dataset(const std::string& path, std::size_t max_keys,
+                 const DatasetOptions& opts) {
+    std::size_t width = key_bytes_for(path, opts.width);
+    key_bits_ = width * 8;
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open file: " + path);
+    }
+    in.seekg(0, std::ios::end);
+    std::size_t bytes = static_cast<std::size_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+
+    std::uint64_t declared = 0;
+    if (bytes < kHeaderBytes ||
+        !in.read(reinterpret_cast<char*>(&declared), sizeof(declared))) {
+        throw std::runtime_error("Missing SOSD key count header: " + path);
+    }
+    if (declared > (bytes - kHeaderBytes) / width ||
+        kHeaderBytes + declared * width != bytes) {
+        throw std::runtime_error(
+            "SOSD size mismatch in " + path + ": header declares " +
+            std::to_string(declared) + " x " + std::to_string(width) +
+            "-byte keys, file has " + std::to_string(bytes - kHeaderBytes) +
+            " payload bytes");
+    }
+    declared_count_ = static_cast<std::size_t>(declared);
+
+    std::size_t total = declared_count_;
+    if (max_keys > 0 && max_keys < total) {
+        total = max_keys;
+    }
+    if (total == 0) {
+        throw std::runtime_error("Empty dataset: " + path);
+    }
+
+#ifdef DATASET_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        // Only map the prefix we are going to use
+        std::size_t len = kHeaderBytes + total * width;
+        int flags = MAP_PRIVATE;
+        if (opts.populate) flags |= MAP_POPULATE;
+        void* addr = ::mmap(nullptr, len, PROT_READ, flags, fd, 0);
+        ::close(fd);
+        if (addr != MAP_FAILED) {
+            const unsigned char* payload =
+                static_cast<const unsigned char*>(addr) + kHeaderBytes;
+            if (width == sizeof(std::uint64_t)) {
+                map_addr_ = addr;
+                map_len_ = len;
+#ifdef MADV_HUGEPAGE
+                if (opts.huge_pages) ::madvise(addr, len, MADV_HUGEPAGE);
+#endif
+                // Lookups touch keys at random; don't let readahead pull in neighbours
+                ::madvise(addr, len, MADV_RANDOM);
+                keys_ = KeySpan(reinterpret_cast<const std::uint64_t*>(payload), total);
+            } else {
+                widen_u32(payload, total, owned_);
+                ::munmap(addr, len);
+                keys_ = KeySpan(owned_);
+            }
+            try {
+                validate(path, opts.allow_duplicates);
+            } catch (...) {
+                // The destructor won't run for a throwing constructor
+                if (map_addr_) ::munmap(map_addr_, map_len_);
+                map_addr_ = nullptr;
+                throw;
+            }
+            return;
+        }
+    }
+#endif
+
+    // Fallback: read into an owned buffer
+    if (width == sizeof(std::uint64_t)) {
+        owned_.resize(total);
+        in.read(reinterpret_cast<char*>(owned_.data()),
+                static_cast<std::streamsize>(total * width));
+    } else {
+        std::vector<unsigned char> raw(total * width);
+        in.read(reinterpret_cast<char*>(raw.data()),
+                static_cast<std::streamsize>(raw.size()));
+        widen_u32(raw.data(), total, owned_);
+    }
+    if (!in) {
+        throw std::runtime_error("Failed to read file: " + path);
+    }
+    keys_ = KeySpan(owned_);
+    validate(path, opts.allow_duplicates);
+}
+
+Dataset::~Dataset() {
+#ifdef DATASET_HAVE_MMAP
+    if (map_addr_) ::munmap(map_addr_, map_len_);
+#endif
+}
+
+void Dataset::validate(const std::string& path, bool allow_duplicates) {
+    num_duplicates_ = 0;
+    for (std::size_t i = 1; i < keys_.size(); ++i) {
+        if (keys_[i] < keys_[i - 1]) {
+            throw std::runtime_error(
+                "Dataset not sorted: " + path + " at key " + std::to_string(i));
+        }
+        num_duplicates_ += keys_[i] == keys_[i - 1];
+    }
+    if (!allow_duplicates && num_duplicates_ > 0) {
+        throw std::runtime_error(
+            "Dataset has " + std::to_string(num_duplicates_) +
+            " duplicate keys: " + path);
+    }
+}
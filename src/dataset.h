@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "span.h"
+
+// Key width of a SOSD file. Auto picks it from the "_uint32"/"_uint64"
+// file name suffix and defaults to 64 bits.
+enum class KeyWidth { Auto, U32, U64 };
+
+struct DatasetOptions {
+    bool populate   = true;   // MAP_POPULATE: fault the whole file in at load
+    bool huge_pages = false;  // madvise(MADV_HUGEPAGE), best effort
+    KeyWidth width  = KeyWidth::Auto;
+    bool allow_duplicates = true;  // false: reject files with repeated keys
+};
+
+// Keys of one SOSD dataset file: an 8-byte little-endian key count
+// followed by that many sorted uint32 or uint64 keys.
+//
+// The file size must match the declared count exactly, and the keys are
+// checked for sortedness (and counted for duplicates) in one pass; any
+// violation throws std::runtime_error before an index is built.
+//
+// uint64 files are memory-mapped read-only and keys() views the mapping
+// directly, so the keys are never copied. uint32 files are widened into
+// an owned buffer, as is everything when mmap is unavailable.
+class Dataset {
+public:
+    Dataset(const std::string& path, std::size_t max_keys = 0,
+            const DatasetOptions& opts = DatasetOptions());
+    ~Dataset();
+
+    Dataset(const Dataset&) = delete;
+    Dataset& operator=(const Dataset&) = delete;
+
+    KeySpan keys() const { return keys_; }
+    bool is_mapped() const { return map_addr_ != nullptr; }
+
+    std::size_t key_bits() const { return key_bits_; }
+    std::size_t declared_count() const { return declared_count_; }
+    std::size_t num_duplicates() const { return num_duplicates_; }
+
+private:
+    void* map_addr_ = nullptr;
+    std::size_t map_len_ = 0;
+    std::vector<std::uint64_t> owned_;
+    KeySpan keys_;
+
+    std::size_t key_bits_ = 64;
+    std::size_t declared_count_ = 0;
+    std::size_t num_duplicates_ = 0;
+
+    void validate(const std::string& path, bool allow_duplicates);
+};
@@ -0,0 +1,242 @@
+#include "delta_rmi.h"
+
+#include <chrono>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace {
+
+// Spread reader threads over the counters round-robin
+std::size_t reader_stripe(std::size_t stripes) {
+    static std::atomic<std::size_t> next{0};
+    thread_local const std::size_t stripe = next.fetch_add(1, std::memory_order_relaxed);
+    return stripe % stripes;
+}
+
+} // namespace
+
+DeltaRMI::Pin::Pin(const DeltaRMI& index) {
+    // Count in the half for the epoch, and make sure it is still current
+    // once counted: a retire() that bumped it in between may not have
+    // waited for this half, and the next one waits for the other
+    std::size_t stripe = reader_stripe(kReaderStripes);
+    for (;;) {
+        std::size_t epoch = index.epoch_.load();
+        count_ = &index.readers_[epoch & 1][stripe];
+        count_->n.fetch_add(1);
+        if (index.epoch_.load() == epoch) break;
+        count_->n.fetch_sub(1);
+    }
+    snap_ = index.current_.load();
+}
+
+DeltaRMI::DeltaRMI(std::size_t num_leaves)
+    : num_leaves_(num_leaves),
+      current_(new Snapshot{std::make_shared<const Main>(num_leaves), nullptr,
+                            std::make_shared<BPTree>()}),
+      epoch_(0),
+      delta_entries_(0),
+      merging_(false),
+      stop_merger_(false),
+      threshold_(0) {}
+
+DeltaRMI::~DeltaRMI() {
+    stop_background_merge();
+    delete current_.load();
+}
+
+void DeltaRMI::bulk_load(KeySpan keys) {
+    auto main = std::make_shared<Main>(num_leaves_);
+    if (!keys.empty()) {
+        main->rmi.train(std::vector<std::uint64_t>(keys.begin(), keys.end()));
+        main->vals.resize(keys.size());
+        std::iota(main->vals.begin(), main->vals.end(), std::size_t(0));
+    }
+    delta_entries_ = 0;
+    retire(current_.exchange(
+        new Snapshot{std::move(main), nullptr, std::make_shared<BPTree>()}));
+}
+
+bool DeltaRMI::find(const Snapshot& snap, std::uint64_t key, std::size_t& value) {
+    std::size_t v;
+    if (snap.frozen && snap.frozen->search(key, v)) {
+        if (v == kTombstone) return false;
+        value = v;
+        return true;
+    }
+    std::size_t pos;
+    if (!snap.main->rmi.search(key, pos)) return false;
+    value = snap.main->vals[pos];
+    return true;
+}
+
+bool DeltaRMI::search(std::uint64_t key, std::size_t& value) const {
+    Pin pin(*this);
+    const Snapshot& snap = pin.snapshot();
+    std::size_t v;
+    if (snap.delta->search(key, v)) {
+        if (v == kTombstone) return false;
+        value = v;
+        return true;
+    }
+    return find(snap, key, value);
+}
+
+bool DeltaRMI::contains(const Snapshot& snap, std::uint64_t key) {
+    std::size_t v;
+    if (snap.delta->search(key, v)) return v != kTombstone;
+    return find(snap, key, v);
+}
+
+bool DeltaRMI::insert(std::uint64_t key, std::size_t value) {
+    if (value == kTombstone) {
+        throw std::invalid_argument("DeltaRMI::insert: value is the tombstone");
+    }
+    bool added;
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        Pin pin(*this);
+        const Snapshot& snap = pin.snapshot();
+        added = !contains(snap, key);
+        if (snap.delta->insert(key, value)) ++delta_entries_;
+    }
+    wake_merger();
+    return added;
+}
+
+bool DeltaRMI::erase(std::uint64_t key) {
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        Pin pin(*this);
+        const Snapshot& snap = pin.snapshot();
+        if (!contains(snap, key)) return false;
+        if (snap.delta->insert(key, kTombstone)) ++delta_entries_;
+    }
+    wake_merger();
+    return true;
+}
+
+void DeltaRMI::retire(const Snapshot* old) {
+    std::size_t epoch = epoch_.fetch_add(1);
+    for (const ReaderCount& count : readers_[epoch & 1]) {
+        while (count.n.load() != 0) std::this_thread::yield();
+    }
+    delete old;
+}
+
+void DeltaRMI::merge() {
+    std::lock_guard<std::mutex> merge_lock(merge_mutex_);
+    auto t0 = std::chrono::steady_clock::now();
+
+    // Freeze: the delta joins the snapshot, writers get an empty one
+    const Snapshot* old;
+    const Snapshot* frozen_snap;
+    std::size_t folded;
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        folded = delta_entries_;
+        if (folded == 0) return;
+        old = current_.load();
+        frozen_snap = new Snapshot{old->main, old->delta, std::make_shared<BPTree>()};
+        delta_entries_ = 0;
+        current_.store(frozen_snap);
+    }
+    merging_ = true;
+    retire(old);
+
+    // Build: merge the sorted keys with the frozen delta, dropping
+    // tombstones; delta values win
+    const Main& cur = *frozen_snap->main;
+    const BPTree& frozen = *frozen_snap->frozen;
+    KeySpan keys = cur.rmi.keys();
+    std::vector<std::uint64_t> merged_keys;
+    auto main = std::make_shared<Main>(num_leaves_);
+    merged_keys.reserve(keys.size() + folded);
+    main->vals.reserve(keys.size() + folded);
+    std::size_t i = 0;
+    for (BPTree::Iterator it = frozen.lower_bound(0); it.valid(); ++it) {
+        for (; i < keys.size() && keys[i] < it.key(); ++i) {
+            merged_keys.push_back(keys[i]);
+            main->vals.push_back(cur.vals[i]);
+        }
+        if (i < keys.size() && keys[i] == it.key()) ++i;
+        if (it.value() != kTombstone) {
+            merged_keys.push_back(it.key());
+            main->vals.push_back(it.value());
+        }
+    }
+    for (; i < keys.size(); ++i) {
+        merged_keys.push_back(keys[i]);
+        main->vals.push_back(cur.vals[i]);
+    }
+    if (!merged_keys.empty()) main->rmi.train(std::move(merged_keys));
+
+    // Publish, keeping the live delta, then wait out lookups still on the
+    // frozen snapshot so the old RMI is freed here rather than on the
+    // lookup path
+    retire(current_.exchange(
+        new Snapshot{std::move(main), nullptr, frozen_snap->delta}));
+    auto t1 = std::chrono::steady_clock::now();
+    merging_ = false;
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.merges += 1;
+    stats_.last_delta = folded;
+    stats_.last_seconds = std::chrono::duration<double>(t1 - t0).count();
+    stats_.total_seconds += stats_.last_seconds;
+}
+
+void DeltaRMI::wake_merger() {
+    std::size_t threshold = threshold_.load(std::memory_order_relaxed);
+    if (threshold == 0 || delta_entries_.load(std::memory_order_relaxed) < threshold) return;
+    std::lock_guard<std::mutex> lock(merger_mutex_);
+    merger_cv_.notify_one();
+}
+
+void DeltaRMI::merger_loop() {
+    std::unique_lock<std::mutex> lock(merger_mutex_);
+    for (;;) {
+        merger_cv_.wait(lock, [&] {
+            return stop_merger_ || delta_entries_.load() >= threshold_.load();
+        });
+        if (stop_merger_) return;
+        lock.unlock();
+        merge();
+        lock.lock();
+    }
+}
+
+void DeltaRMI::start_background_merge(std::size_t threshold) {
+    stop_background_merge();
+    if (threshold == 0) return;
+    threshold_ = threshold;
+    stop_merger_ = false;
+    merger_ = std::thread([this] { merger_loop(); });
+}
+
+void DeltaRMI::stop_background_merge() {
+    {
+        std::lock_guard<std::mutex> lock(merger_mutex_);
+        stop_merger_ = true;
+    }
+    merger_cv_.notify_all();
+    if (merger_.joinable()) merger_.join();
+    threshold_ = 0;
+}
+
+DeltaRMI::MergeStats DeltaRMI::merge_stats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+MemoryUsage DeltaRMI::memory_usage() const {
+    Pin pin(*this);
+    const Snapshot& snap = pin.snapshot();
+    MemoryUsage m = snap.main->rmi.memory_usage();
+    m.index_bytes += sizeof(*this) + vector_heap_bytes(snap.main->vals) +
+                     snap.delta->memory_usage().index_bytes;
+    if (snap.frozen) m.index_bytes += snap.frozen->memory_usage().index_bytes;
+    return m;
+}
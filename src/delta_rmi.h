@@ -0,0 +1,154 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bpt.h"
+#include "memory.h"
+#include "rmi.h"
+#include "span.h"
+
+// A read-optimised RMI made writable by a small B+Tree delta in front of
+// it. Inserts and erases go to the delta (an erase leaves a tombstone);
+// lookups check the delta first, then the RMI. merge() folds the delta
+// into a new key array and retrains a new RMI while lookups and writes go
+// on, then swaps it in RCU-style:
+//
+//   1. freeze: under the writers' lock, a snapshot is published in which
+//      the delta is frozen and a fresh one takes writes;
+//   2. build: the frozen delta and the current RMI are merged and a new
+//      RMI is trained, with no locks held;
+//   3. publish: the snapshot pointer is swapped atomically. Lookups that
+//      loaded the old snapshot finish on it; the merging thread waits for
+//      them and frees it, so reclamation stays off the lookup path.
+//
+// Lookups take no locks: they pin the current epoch in a counter picked by
+// thread, load the snapshot (RMI, frozen delta and the live delta, a
+// BPTree whose optimistic lock coupling lets them run alongside the
+// writer) and unpin. Writers are serialised among themselves.
+//
+// All member functions may be called concurrently, except bulk_load(),
+// which must not overlap anything else.
+class DeltaRMI {
+public:
+    // Values are positions as in the other indexes; this one is reserved
+    // for tombstones
+    static constexpr std::size_t kTombstone = ~std::size_t(0);
+
+    struct MergeStats {
+        std::size_t merges = 0;
+        std::size_t last_delta = 0;     // delta entries folded by the last merge
+        double last_seconds = 0.0;      // freeze to publish
+        double total_seconds = 0.0;
+    };
+
+    explicit DeltaRMI(std::size_t num_leaves = 64);
+    ~DeltaRMI();
+
+    DeltaRMI(const DeltaRMI&) = delete;
+    DeltaRMI& operator=(const DeltaRMI&) = delete;
+
+    // keys must be sorted; key i gets value i. Copies the keys.
+    void bulk_load(KeySpan keys);
+
+    // Add key with value (overwriting a present key's value); returns
+    // false if key was present. Throws std::invalid_argument for
+    // value == kTombstone.
+    bool insert(std::uint64_t key, std::size_t value);
+
+    // Remove key; returns false if it was not present
+    bool erase(std::uint64_t key);
+
+    bool search(std::uint64_t key, std::size_t& value) const;
+
+    // Fold the delta into the RMI now; returns once the new RMI is
+    // published. Merges never overlap; a no-op if the delta is empty.
+    void merge();
+
+    // Run merge() on a background thread whenever the delta holds at
+    // least threshold entries, until stop_background_merge() or
+    // destruction
+    void start_background_merge(std::size_t threshold);
+    void stop_background_merge();
+
+    bool merging() const { return merging_.load(std::memory_order_relaxed); }
+    std::size_t delta_size() const { return delta_entries_.load(std::memory_order_relaxed); }
+    MergeStats merge_stats() const;
+
+    // RMI, value array and both deltas of the current snapshot
+    MemoryUsage memory_usage() const;
+
+private:
+    // Immutable once published
+    struct Main {
+        explicit Main(std::size_t num_leaves) : rmi(num_leaves) {}
+        RMI rmi;                          // owns its keys
+        std::vector<std::size_t> vals;    // vals[position]
+    };
+    struct Snapshot {
+        std::shared_ptr<const Main> main;
+        std::shared_ptr<const BPTree> frozen;   // delta being merged, or null
+        std::shared_ptr<BPTree> delta;          // takes writes
+    };
+
+    // Readers count themselves in one of kReaderStripes counters (by
+    // thread) of the half for the epoch, retrying if the epoch moved on
+    // meanwhile. Reclaiming a snapshot bumps the epoch after publishing its
+    // successor and waits for the old half to drain; anyone counted later
+    // loads the successor.
+    static constexpr std::size_t kReaderStripes = 64;
+    struct alignas(64) ReaderCount {
+        std::atomic<std::size_t> n{0};
+    };
+
+    // Pins the current snapshot for its lifetime
+    class Pin {
+    public:
+        explicit Pin(const DeltaRMI& index);
+        ~Pin() { count_->n.fetch_sub(1); }
+        Pin(const Pin&) = delete;
+        Pin& operator=(const Pin&) = delete;
+        const Snapshot& snapshot() const { return *snap_; }
+
+    private:
+        ReaderCount* count_;
+        const Snapshot* snap_;
+    };
+
+    std::size_t num_leaves_;
+
+    std::atomic<const Snapshot*> current_;
+    mutable std::atomic<std::size_t> epoch_;
+    mutable ReaderCount readers_[2][kReaderStripes];
+    std::mutex write_mutex_;              // one writer at a time
+    std::atomic<std::size_t> delta_entries_;
+
+    std::mutex merge_mutex_;              // one merge at a time
+    std::atomic<bool> merging_;
+    mutable std::mutex stats_mutex_;
+    MergeStats stats_;
+
+    std::thread merger_;
+    std::mutex merger_mutex_;
+    std::condition_variable merger_cv_;
+    bool stop_merger_;
+    std::atomic<std::size_t> threshold_;  // 0 = no background merges
+
+    // Look key up in a snapshot: frozen delta, then the RMI
+    static bool find(const Snapshot& snap, std::uint64_t key, std::size_t& value);
+
+    // Present in the snapshot's live delta, frozen delta or RMI
+    static bool contains(const Snapshot& snap, std::uint64_t key);
+
+    // Wait until no reader can still hold old, which has been replaced in
+    // current_, then free it
+    void retire(const Snapshot* old);
+
+    void wake_merger();
+    void merger_loop();
+};
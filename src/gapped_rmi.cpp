@@ -0,0 +1,454 @@
+#include "gapped_rmi.h"
+#include "last_mile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+
+constexpr std::size_t kNone = ~std::size_t(0);
+
+// Slots for n entries at the initial density
+std::size_t capacity_for(std::size_t n) {
+    auto cap = static_cast<std::size_t>(
+        std::ceil(static_cast<double>(n) / GappedRMI::kInitDensity));
+    return std::max(cap, GappedRMI::kMinLeafSlots);
+}
+
+inline void set_bit(std::vector<std::uint64_t>& bits, std::size_t i) {
+    bits[i >> 6] |= std::uint64_t(1) << (i & 63);
+}
+
+// First i in [from, n) whose bit is Set, n if none
+template <bool Set>
+std::size_t find_next(const std::vector<std::uint64_t>& bits, std::size_t from, std::size_t n) {
+    if (from >= n) return n;
+    std::size_t w = from >> 6;
+    std::uint64_t word = (Set ? bits[w] : ~bits[w]) & (~std::uint64_t(0) << (from & 63));
+    while (word == 0) {
+        if (++w == bits.size()) return n;
+        word = Set ? bits[w] : ~bits[w];
+    }
+    std::size_t i = (w << 6) + static_cast<std::size_t>(__builtin_ctzll(word));
+    return std::min(i, n);
+}
+
+// Last i < from whose bit is clear, kNone if none
+std::size_t find_prev_gap(const std::vector<std::uint64_t>& bits, std::size_t from) {
+    if (from == 0) return kNone;
+    std::size_t i = from - 1;
+    std::size_t w = i >> 6;
+    std::uint64_t word = ~bits[w] & (~std::uint64_t(0) >> (63 - (i & 63)));
+    while (word == 0) {
+        if (w == 0) return kNone;
+        word = ~bits[--w];
+    }
+    return (w << 6) + 63 - static_cast<std::size_t>(__builtin_clzll(word));
+}
+
+} // namespace
+
+GappedRMI::GappedRMI(std::size_t num_leaves)
+    : initial_leaves_(std::max<std::size_t>(num_leaves, 1)), num_keys_(0), key_base_(0),
+      offset_(0), slot_limit_(0.0) {
+    bulk_load(KeySpan());
+}
+
+double GappedRMI::root_slot(std::uint64_t key) const {
+    double p = key >= key_base_
+                   ? root_.predict(key - key_base_)
+                   : root_.b - root_.a * static_cast<double>(key_base_ - key);
+    // Whole slots before adding the offset, so the sum is exact and
+    // doubling or halving the root keeps every key in its slot's pair
+    return std::floor(p) + static_cast<double>(offset_);
+}
+
+std::size_t GappedRMI::slot_for(std::uint64_t key) const {
+    double s = root_slot(key);
+    if (s <= 0.0) return 0;
+    if (s >= slot_limit_) return slots_.size() - 1;
+    return static_cast<std::size_t>(s);
+}
+
+std::size_t GappedRMI::predict(const Leaf& leaf, std::uint64_t key) {
+    double p = leaf.model.predict(key > leaf.base ? key - leaf.base : 0);
+    std::size_t cap = leaf.keys.size();
+    if (p <= 0.0) return 0;
+    if (p >= static_cast<double>(cap)) return cap - 1;
+    return static_cast<std::size_t>(p);
+}
+
+std::size_t GappedRMI::upper_slot(const Leaf& leaf, std::uint64_t key, std::size_t pred) {
+    if (key == ~std::uint64_t(0)) return leaf.end;
+    return exponential_lower_bound(leaf.keys.data(), pred, 0, leaf.end, key + 1);
+}
+
+void GappedRMI::build(Leaf& leaf, const std::uint64_t* keys, const std::uint64_t* vals,
+                      std::size_t n, std::size_t capacity) {
+    leaf.keys.assign(capacity, ~std::uint64_t(0));
+    leaf.vals.assign(capacity, 0);
+    leaf.used.assign((capacity + 63) / 64, 0);
+    leaf.num_keys = n;
+    leaf.end = 0;
+    leaf.inserts = 0;
+    leaf.insert_cost = 0;
+    leaf.base = n > 0 ? keys[0] : 0;
+    leaf.model = LinearModel();
+    if (n == 0) return;
+
+    // Fit key -> rank, stretched over the slots
+    leaf.model.fit(KeySpan(keys, n), 0, leaf.base, 1);
+    leaf.model.scale(static_cast<double>(capacity) / static_cast<double>(n));
+
+    // Each entry at its prediction if that is near its evenly spaced slot,
+    // else at the evenly spaced slot, so a badly fitting model does not
+    // pack keys into long runs without gaps. Pushed right past the previous
+    // entry, and left enough for the rest to fit.
+    std::size_t next = 0;
+    double spacing = static_cast<double>(capacity) / static_cast<double>(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        std::size_t pred = predict(leaf, keys[i]);
+        auto even = static_cast<std::size_t>(static_cast<double>(i) * spacing);
+        std::size_t target = (pred > even ? pred - even : even - pred) <= kMaxInsertCost ? pred : even;
+        std::size_t pos = std::min(std::max(target, next), capacity - (n - i));
+        leaf.keys[pos] = keys[i];
+        leaf.vals[pos] = vals[i];
+        set_bit(leaf.used, pos);
+        next = pos + 1;
+    }
+    leaf.end = next;
+
+    // Gaps take the key of the next used slot
+    std::uint64_t v = ~std::uint64_t(0);
+    for (std::size_t s = leaf.end; s-- > 0;) {
+        if (leaf.used[s >> 6] >> (s & 63) & 1) {
+            v = leaf.keys[s];
+        } else {
+            leaf.keys[s] = v;
+        }
+    }
+}
+
+void GappedRMI::collect(const Leaf& leaf, std::vector<std::uint64_t>& keys,
+                        std::vector<std::uint64_t>& vals) {
+    keys.clear();
+    vals.clear();
+    keys.reserve(leaf.num_keys);
+    vals.reserve(leaf.num_keys);
+    for (std::size_t s = find_next<true>(leaf.used, 0, leaf.end); s < leaf.end;
+         s = find_next<true>(leaf.used, s + 1, leaf.end)) {
+        keys.push_back(leaf.keys[s]);
+        vals.push_back(leaf.vals[s]);
+    }
+}
+
+void GappedRMI::bulk_load(KeySpan keys) {
+    std::vector<std::uint64_t> vals(keys.size());
+    std::iota(vals.begin(), vals.end(), std::uint64_t(0));
+    stats_ = Stats();
+    load(keys, vals.data());
+}
+
+void GappedRMI::load(KeySpan keys, const std::uint64_t* vals) {
+    std::size_t n = keys.size();
+    std::size_t num_slots = initial_leaves_;
+    num_keys_ = n;
+    key_base_ = n > 0 ? keys[0] : 0;
+    offset_ = 0;
+
+    root_ = LinearModel();
+    if (n > 0) {
+        root_.fit(keys, 0, key_base_, 1);
+        root_.scale(static_cast<double>(num_slots) / static_cast<double>(n));
+    }
+    slots_.resize(num_slots);
+    slot_limit_ = static_cast<double>(num_slots);
+
+    // One leaf per slot; routing is monotone, so each gets a run of keys
+    leaves_.clear();
+    leaves_.resize(num_slots);
+    std::size_t i = 0;
+    for (std::size_t s = 0; s < num_slots; ++s) {
+        std::size_t start = i;
+        while (i < n && slot_for(keys[i]) == s) ++i;
+        Leaf& leaf = leaves_[s];
+        leaf.slot_lo = static_cast<std::uint32_t>(s);
+        leaf.slot_hi = static_cast<std::uint32_t>(s + 1);
+        slots_[s] = static_cast<std::uint32_t>(s);
+        build(leaf, keys.data() + start, vals + start, i - start, capacity_for(i - start));
+    }
+}
+
+void GappedRMI::retrain_root() {
+    std::vector<std::uint64_t> keys, vals, leaf_keys, leaf_vals;
+    keys.reserve(num_keys_);
+    vals.reserve(num_keys_);
+    for (std::size_t s = 0; s < slots_.size(); s = leaves_[slots_[s]].slot_hi) {
+        collect(leaves_[slots_[s]], leaf_keys, leaf_vals);
+        keys.insert(keys.end(), leaf_keys.begin(), leaf_keys.end());
+        vals.insert(vals.end(), leaf_vals.begin(), leaf_vals.end());
+    }
+    load(keys, vals.data());
+    ++stats_.root_retrains;
+}
+
+bool GappedRMI::search(std::uint64_t key, std::size_t& value) const {
+    const Leaf& leaf = leaves_[slots_[slot_for(key)]];
+    std::size_t ub = upper_slot(leaf, key, predict(leaf, key));
+    // The last slot holding key is the used one; gaps before it copy it
+    if (ub == 0 || leaf.keys[ub - 1] != key) return false;
+    value = leaf.vals[ub - 1];
+    return true;
+}
+
+bool GappedRMI::insert(std::uint64_t key, std::size_t value) {
+    // Widen the root for keys just past its key domain (at most doubling
+    // it); keys further out wait in the edge leaf until it splits
+    double s = root_slot(key);
+    if (root_.a > 0.0 && (s < 0.0 || s >= slot_limit_) &&
+        (s < 0.0 ? -s : s + 1.0 - slot_limit_) <= slot_limit_) {
+        extend_root(key);
+    }
+    std::uint32_t id = slots_[slot_for(key)];
+    Leaf& leaf = leaves_[id];
+    std::size_t pred = predict(leaf, key);
+    std::size_t ub = upper_slot(leaf, key, pred);
+    if (ub > 0 && leaf.keys[ub - 1] == key) {
+        leaf.vals[ub - 1] = value;
+        return false;
+    }
+    std::size_t cap = leaf.keys.size();
+    if (static_cast<double>(leaf.num_keys + 1) > kMaxDensity * static_cast<double>(cap)) {
+        grow(id);
+        return insert(key, value);
+    }
+
+    // key belongs after slot ub - 1 (used, or ub = 0) and before the next
+    // used slot r: take a gap in [ub, r) near the prediction, or else
+    // shift entries toward the nearest gap
+    std::size_t r = find_next<true>(leaf.used, ub, cap);
+    std::size_t pos, cost;
+    if (r > ub) {
+        if (ub == leaf.end && pred + 1 == cap) {
+            pos = ub;       // past the last entry and the model: append
+        } else if (ub == 0 && pred == 0 && r < cap) {
+            pos = r - 1;    // before the first entry and the model: prepend
+        } else {
+            pos = std::min(std::max(pred, ub), r - 1);
+        }
+        std::fill(leaf.keys.begin() + ub, leaf.keys.begin() + pos, key);
+        cost = 0;
+    } else {
+        std::size_t right = find_next<false>(leaf.used, ub, cap);
+        std::size_t left = find_prev_gap(leaf.used, ub);
+        if (right < cap && (left == kNone || right - ub <= ub - left)) {
+            std::copy_backward(leaf.keys.begin() + ub, leaf.keys.begin() + right,
+                               leaf.keys.begin() + right + 1);
+            std::copy_backward(leaf.vals.begin() + ub, leaf.vals.begin() + right,
+                               leaf.vals.begin() + right + 1);
+            set_bit(leaf.used, right);
+            leaf.end = std::max(leaf.end, right + 1);
+            pos = ub;
+            cost = right - ub;
+        } else {
+            std::copy(leaf.keys.begin() + left + 1, leaf.keys.begin() + ub,
+                      leaf.keys.begin() + left);
+            std::copy(leaf.vals.begin() + left + 1, leaf.vals.begin() + ub,
+                      leaf.vals.begin() + left);
+            set_bit(leaf.used, left);
+            pos = ub - 1;
+            cost = ub - 1 - left;
+        }
+    }
+    leaf.keys[pos] = key;
+    leaf.vals[pos] = value;
+    set_bit(leaf.used, pos);
+    leaf.end = std::max(leaf.end, pos + 1);
+    ++leaf.num_keys;
+    ++num_keys_;
+
+    // Retrain once inserts keep landing far from where the model says
+    cost += pos > pred ? pos - pred : pred - pos;
+    ++leaf.inserts;
+    leaf.insert_cost += cost;
+    // (or split, if it is big enough that halves get a better fit)
+    if (leaf.inserts >= std::max(kMinInsertsBeforeRetrain, leaf.num_keys / kRetrainEvery) &&
+        leaf.insert_cost > kMaxInsertCost * leaf.inserts) {
+        if (leaf.num_keys >= kMinSplitKeys && split(id)) return true;
+        std::vector<std::uint64_t> keys, vals;
+        collect(leaf, keys, vals);
+        build(leaf, keys.data(), vals.data(), keys.size(), cap);
+        ++stats_.retrains;
+    }
+    return true;
+}
+
+void GappedRMI::grow(std::uint32_t id) {
+    Leaf& leaf = leaves_[id];
+    std::size_t cap = capacity_for(leaf.num_keys + 1);
+    if (cap > kMaxLeafSlots && split(id)) return;
+    std::vector<std::uint64_t> keys, vals;
+    collect(leaf, keys, vals);
+    build(leaf, keys.data(), vals.data(), keys.size(), cap);
+    ++stats_.expansions;
+}
+
+bool GappedRMI::split(std::uint32_t id) {
+    std::vector<std::uint64_t> keys, vals;
+    collect(leaves_[id], keys, vals);
+    std::size_t n = keys.size();
+    if (n < 2) return false;
+
+    // A root fitted to fewer than two keys routes everything to one slot,
+    // and no refinement separates keys; fit it to all entries instead
+    if (!(root_.a > 0.0)) {
+        retrain_root();
+        return true;
+    }
+
+    // Refine the root until the leaf's keys span at least two slots. An
+    // edge leaf's keys may lie outside the root's key domain and all land
+    // in its edge slot; widen the domain to cover the median first.
+    while (slot_for(keys.front()) == slot_for(keys.back())) {
+        double s = root_slot(keys[n / 2]);
+        if (root_.a > 0.0 && (s < 0.0 || s >= slot_limit_)) {
+            // Halving renumbers and merges leaves; callers look the key up
+            // again, which grows or splits the leaf it is in now
+            std::size_t halvings = stats_.root_halvings;
+            extend_root(keys[n / 2]);
+            if (stats_.root_halvings != halvings) return true;
+            continue;
+        }
+        if (slots_.size() * 2 > kMaxRootSlots) return false;
+        double_root();
+    }
+
+    // Cut at the slot boundary nearest the median key, leaving both
+    // halves at least one key
+    std::uint32_t hi = leaves_[id].slot_hi;
+    std::size_t mid = std::max(slot_for(keys[n / 2]), slot_for(keys.front()) + 1);
+    mid = std::min(mid, slot_for(keys.back()));
+    std::size_t cut = static_cast<std::size_t>(
+        std::partition_point(keys.begin(), keys.end(),
+                             [&](std::uint64_t k) { return slot_for(k) < mid; }) -
+        keys.begin());
+
+    auto right_id = static_cast<std::uint32_t>(leaves_.size());
+    leaves_.emplace_back();
+    Leaf& left = leaves_[id];
+    Leaf& right = leaves_.back();
+    left.slot_hi = static_cast<std::uint32_t>(mid);
+    right.slot_lo = static_cast<std::uint32_t>(mid);
+    right.slot_hi = hi;
+    std::fill(slots_.begin() + mid, slots_.begin() + hi, right_id);
+    build(left, keys.data(), vals.data(), cut, capacity_for(cut));
+    build(right, keys.data() + cut, vals.data() + cut, n - cut, capacity_for(n - cut));
+    ++stats_.splits;
+    return true;
+}
+
+void GappedRMI::double_root() {
+    // Scaling by 2 is exact, so slot s's keys now land in 2s or 2s + 1
+    std::vector<std::uint32_t> slots(slots_.size() * 2);
+    for (std::size_t s = 0; s < slots_.size(); ++s) {
+        slots[2 * s] = slots[2 * s + 1] = slots_[s];
+    }
+    slots_.swap(slots);
+    root_.scale(2.0);
+    offset_ *= 2;
+    slot_limit_ = static_cast<double>(slots_.size());
+    for (Leaf& leaf : leaves_) {
+        leaf.slot_lo *= 2;
+        leaf.slot_hi *= 2;
+    }
+    ++stats_.root_doublings;
+}
+
+void GappedRMI::extend_root(std::uint64_t key) {
+    for (;;) {
+        double s = root_slot(key);
+        double size = slot_limit_;
+        double room = static_cast<double>(kMaxRootSlots) - size;
+        double need = s < 0.0 ? -s : s + 1.0 - size;
+        if (need <= 0.0) return;
+        if (need <= room) {
+            auto n = static_cast<std::size_t>(std::min(std::max(need, size / 2), room));
+            if (s < 0.0) {
+                add_slots_front(n);
+            } else {
+                add_slots_back(n);
+            }
+            ++stats_.root_extensions;
+            return;
+        }
+        halve_root();
+    }
+}
+
+void GappedRMI::add_slots_front(std::size_t n) {
+    std::uint32_t id = slots_.front();
+    slots_.insert(slots_.begin(), n, id);
+    for (Leaf& leaf : leaves_) {
+        leaf.slot_lo += static_cast<std::uint32_t>(n);
+        leaf.slot_hi += static_cast<std::uint32_t>(n);
+    }
+    leaves_[id].slot_lo = 0;
+    offset_ += n;
+    slot_limit_ = static_cast<double>(slots_.size());
+}
+
+void GappedRMI::add_slots_back(std::size_t n) {
+    std::uint32_t id = slots_.back();
+    slots_.resize(slots_.size() + n, id);
+    leaves_[id].slot_hi = static_cast<std::uint32_t>(slots_.size());
+    slot_limit_ = static_cast<double>(slots_.size());
+}
+
+void GappedRMI::halve_root() {
+    // With the offset and the slot count even, old slot s maps to s / 2
+    if (offset_ % 2 != 0) add_slots_front(1);
+    if (slots_.size() % 2 != 0) add_slots_back(1);
+
+    std::vector<std::uint32_t> slots(slots_.size() / 2);
+    std::vector<Leaf> leaves;
+    std::vector<std::uint64_t> keys, vals, more_keys, more_vals;
+    for (std::size_t lo = 0; lo < slots_.size();) {
+        Leaf leaf = std::move(leaves_[slots_[lo]]);
+        std::size_t hi = leaf.slot_hi;
+        if (hi % 2 != 0) {
+            // Ends inside a pair: take in the leaves up to the next pair
+            collect(leaf, keys, vals);
+            while (hi % 2 != 0) {
+                const Leaf& next = leaves_[slots_[hi]];
+                collect(next, more_keys, more_vals);
+                keys.insert(keys.end(), more_keys.begin(), more_keys.end());
+                vals.insert(vals.end(), more_vals.begin(), more_vals.end());
+                hi = next.slot_hi;
+            }
+            build(leaf, keys.data(), vals.data(), keys.size(), capacity_for(keys.size()));
+        }
+        auto id = static_cast<std::uint32_t>(leaves.size());
+        leaf.slot_lo = static_cast<std::uint32_t>(lo / 2);
+        leaf.slot_hi = static_cast<std::uint32_t>(hi / 2);
+        std::fill(slots.begin() + lo / 2, slots.begin() + hi / 2, id);
+        leaves.push_back(std::move(leaf));
+        lo = hi;
+    }
+    slots_.swap(slots);
+    leaves_.swap(leaves);
+    root_.scale(0.5);
+    offset_ /= 2;
+    slot_limit_ = static_cast<double>(slots_.size());
+    ++stats_.root_halvings;
+}
+
+MemoryUsage GappedRMI::memory_usage() const {
+    MemoryUsage m;
+    m.index_bytes = sizeof(*this) + vector_heap_bytes(slots_) + vector_heap_bytes(leaves_);
+    for (const Leaf& leaf : leaves_) {
+        m.index_bytes += vector_heap_bytes(leaf.keys) + vector_heap_bytes(leaf.vals) +
+                         vector_heap_bytes(leaf.used);
+    }
+    return m;
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "memory.h"
+#include "models.h"
+#include "span.h"
+
+// Updatable learned index in the style of ALEX: a linear root model routes
+// each key to one of num_slots slots, and every leaf owns a contiguous run
+// of slots. Leaves keep their entries in a gapped array laid out by the
+// leaf's own linear model (evenly spaced where the model fits badly), so
+// an insert usually lands in a free slot at or near its predicted position
+// and moves nothing.
+//
+// Gaps hold the key of the next used slot to their right, so each leaf's
+// key array stays sorted and lookups are an exponential search from the
+// prediction. A leaf is rebuilt alone when it gets too dense (expanded, or
+// split in two along its slot run, doubling the root's slots if the leaf
+// owns only one) or when inserts land too far from their prediction
+// (split if large, else retrained in place). Other leaves are untouched.
+//
+// Keys past either end of the root's key domain widen it: slots are added
+// at that end and handed to the edge leaf, halving the root (merging leaves
+// that share a slot pair) if the slot array would pass kMaxRootSlots. Keys
+// far outside are left in the edge leaf until it splits. A root fitted to
+// fewer than two keys (an empty or one-key bulk load) is refitted to all
+// entries the first time a leaf must split.
+class GappedRMI {
+public:
+    // Leaves start at kInitDensity, expand past kMaxDensity, and split
+    // instead once expanding would exceed kMaxLeafSlots slots
+    static constexpr double kInitDensity = 0.6;
+    static constexpr double kMaxDensity = 0.8;
+    static constexpr std::size_t kMinLeafSlots = 16;
+    static constexpr std::size_t kMaxLeafSlots = std::size_t(1) << 16;
+    // Root slot array cap; beyond it full one-slot leaves expand instead
+    static constexpr std::size_t kMaxRootSlots = std::size_t(1) << 20;
+    // Retrain a leaf once its inserts average more than this many slots
+    // of distance from the prediction plus entries shifted. Retraining
+    // waits for kMinInsertsBeforeRetrain inserts and for one per
+    // kRetrainEvery entries, so a leaf its model cannot fit is not
+    // rebuilt over and over.
+    static constexpr std::size_t kMaxInsertCost = 16;
+    static constexpr std::size_t kMinInsertsBeforeRetrain = 64;
+    static constexpr std::size_t kRetrainEvery = 8;
+    // Leaves this big split rather than retrain
+    static constexpr std::size_t kMinSplitKeys = 1024;
+
+    // Structural changes since bulk_load()
+    struct Stats {
+        std::size_t expansions = 0;
+        std::size_t splits = 0;
+        std::size_t retrains = 0;
+        std::size_t root_doublings = 0;
+        std::size_t root_extensions = 0;
+        std::size_t root_halvings = 0;
+        std::size_t root_retrains = 0;
+    };
+
+    explicit GappedRMI(std::size_t num_leaves = 64);
+
+    // keys must be sorted; key i gets value i, as in BPTree::bulk_load.
+    // The index keeps its own copy.
+    void bulk_load(KeySpan keys);
+
+    // Add key with value; if key is present its value is overwritten and
+    // false is returned
+    bool insert(std::uint64_t key, std::size_t value);
+
+    bool search(std::uint64_t key, std::size_t& value) const;
+
+    std::size_t size() const { return num_keys_; }
+    std::size_t num_leaves() const { return leaves_.size(); }
+    std::size_t num_slots() const { return slots_.size(); }
+    const Stats& stats() const { return stats_; }
+
+    // Exact bytes held, gaps included; leaves own their keys, so
+    // data_bytes is 0
+    MemoryUsage memory_usage() const;
+
+private:
+    struct Leaf {
+        LinearModel model;                // key - base -> slot in keys
+        std::uint64_t base = 0;
+        std::vector<std::uint64_t> keys;  // gapped, sorted
+        std::vector<std::uint64_t> vals;
+        std::vector<std::uint64_t> used;  // bitmap of used slots
+        std::size_t num_keys = 0;
+        std::size_t end = 0;              // one past the last used slot
+        std::uint32_t slot_lo = 0;        // root slots [slot_lo, slot_hi)
+        std::uint32_t slot_hi = 0;
+        std::size_t inserts = 0;          // since the last rebuild
+        std::size_t insert_cost = 0;
+    };
+
+    std::size_t initial_leaves_;
+    std::size_t num_keys_;
+    std::uint64_t key_base_;       // smallest bulk-loaded key
+    LinearModel root_;             // predicts slots (scaled by num_slots / n)
+    std::size_t offset_;           // slots added in front of the model's slot 0
+    double slot_limit_;            // slots_.size()
+    std::vector<std::uint32_t> slots_;   // slot -> leaf id
+    std::vector<Leaf> leaves_;
+    Stats stats_;
+
+    // Root slot of key, not clamped to [0, slots_.size())
+    double root_slot(std::uint64_t key) const;
+    std::size_t slot_for(std::uint64_t key) const;
+
+    // Leaf model prediction clamped to the leaf's slots
+    static std::size_t predict(const Leaf& leaf, std::uint64_t key);
+
+    // First slot in [0, leaf.end) whose key is > key
+    static std::size_t upper_slot(const Leaf& leaf, std::uint64_t key, std::size_t pred);
+
+    // bulk_load() with the given values; stats are kept
+    void load(KeySpan keys, const std::uint64_t* vals);
+
+    // Lay out n sorted entries model-based over capacity slots
+    static void build(Leaf& leaf, const std::uint64_t* keys, const std::uint64_t* vals,
+                      std::size_t n, std::size_t capacity);
+
+    // The leaf's entries in key order
+    static void collect(const Leaf& leaf, std::vector<std::uint64_t>& keys,
+                        std::vector<std::uint64_t>& vals);
+
+    // Make room in leaf id for one more entry: expand, or split it
+    void grow(std::uint32_t id);
+
+    // Split leaf id in two at the slot boundary nearest its median key,
+    // widening the root's key domain to the median if it lies outside and
+    // doubling the root's slots until its keys span two of them; false if
+    // that would exceed kMaxRootSlots. Returns true without splitting if
+    // widening halved the root or the root was retrained, as leaf ids
+    // have changed.
+    bool split(std::uint32_t id);
+    void double_root();
+
+    // Refit the root to all entries and rebuild every leaf, as bulk_load()
+    // does but keeping the values
+    void retrain_root();
+
+    // Add slots at the end of the root's key domain that key lies past,
+    // enough to cover it and at least half as many again as there are,
+    // halving the root first while that would pass kMaxRootSlots
+    void extend_root(std::uint64_t key);
+    void add_slots_front(std::size_t n);
+    void add_slots_back(std::size_t n);
+    // Slots 2t and 2t + 1 become slot t; leaves sharing a pair merge
+    void halve_root();
+};
@@ -0,0 +1,216 @@
+#include "image.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define IMAGE_HAVE_MMAP 1
+#endif
+
+namespace {
+
+constexpr char kMagic[8] = {'L', 'I', 'D', 'X', 'I', 'M', 'G', '\0'};
+constexpr std::uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr std::uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr std::size_t kBufferAlign = 4096;
+
+inline std::uint64_t rotl(std::uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+std::uint64_t header_checksum(ImageHeader h) {
+    h.header_checksum = 0;
+    Checksum64 sum;
+    sum.update(&h, sizeof(h));
+    return sum.digest();
+}
+
+} // namespace
+
+void Checksum64::mix(std::uint64_t word) {
+    std::uint64_t& lane = lanes_[words_ & 3];
+    lane = rotl(lane + word * kPrime2, 31) * kPrime1;
+    ++words_;
+}
+
+void Checksum64::update(const void* data, std::size_t bytes) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    // Complete a word left over from the previous call
+    while (tail_len_ > 0 && bytes > 0) {
+        tail_[tail_len_++] = *p++;
+        --bytes;
+        if (tail_len_ == 8) {
+            std::uint64_t w;
+            std::memcpy(&w, tail_, 8);
+            mix(w);
+            tail_len_ = 0;
+        }
+    }
+    // Whole words; four at a time once lined up with lane 0, so the lanes'
+    // multiply chains run in parallel
+    while (bytes >= 8 && (words_ & 3) != 0) {
+        std::uint64_t w;
+        std::memcpy(&w, p, 8);
+        mix(w);
+        p += 8;
+        bytes -= 8;
+    }
+    for (; bytes >= 32; p += 32, bytes -= 32) {
+        for (int i = 0; i < 4; ++i) {
+            std::uint64_t w;
+            std::memcpy(&w, p + 8 * i, 8);
+            lanes_[i] = rotl(lanes_[i] + w * kPrime2, 31) * kPrime1;
+        }
+        words_ += 4;
+    }
+    for (; bytes >= 8; p += 8, bytes -= 8) {
+        std::uint64_t w;
+        std::memcpy(&w, p, 8);
+        mix(w);
+    }
+    std::memcpy(tail_, p, bytes);
+    tail_len_ = bytes;
+}
+
+std::uint64_t Checksum64::digest() const {
+    std::uint64_t h = rotl(lanes_[0], 1) + rotl(lanes_[1], 7) +
+                      rotl(lanes_[2], 12) + rotl(lanes_[3], 18);
+    h ^= (words_ * 8 + tail_len_) * kPrime1;
+    for (std::size_t i = 0; i < tail_len_; ++i) {
+        h = rotl(h ^ (tail_[i] * kPrime2), 11) * kPrime1;
+    }
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    return h;
+}
+
+ImageWriter::ImageWriter(const std::string& path, ImageKind kind)
+    : path_(path), tmp_path_(path + ".tmp"),
+      out_(tmp_path_, std::ios::binary | std::ios::trunc),
+      kind_(kind), offset_(sizeof(ImageHeader)) {
+    if (!out_) {
+        throw std::runtime_error("Cannot create image: " + tmp_path_);
+    }
+    // Header is filled in by finish()
+    ImageHeader blank{};
+    out_.write(reinterpret_cast<const char*>(&blank), sizeof(blank));
+}
+
+void ImageWriter::write(const void* data, std::size_t bytes) {
+    out_.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+    sum_.update(data, bytes);
+    offset_ += bytes;
+}
+
+void ImageWriter::align(std::size_t alignment) {
+    static const char zeros[kBufferAlign] = {};
+    std::size_t pad = (alignment - offset_ % alignment) % alignment;
+    while (pad > 0) {
+        std::size_t chunk = std::min(pad, sizeof(zeros));
+        write(zeros, chunk);
+        pad -= chunk;
+    }
+}
+
+void ImageWriter::finish() {
+    ImageHeader h{};
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kImageVersion;
+    h.kind = static_cast<std::uint32_t>(kind_);
+    h.file_bytes = offset_;
+    h.payload_checksum = sum_.digest();
+    h.header_checksum = header_checksum(h);
+    out_.seekp(0);
+    out_.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out_.close();
+    if (!out_) {
+        throw std::runtime_error("Failed to write image: " + tmp_path_);
+    }
+    if (std::rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+        throw std::runtime_error("Cannot rename image into place: " + path_);
+    }
+}
+
+MappedImage::MappedImage(const std::string& path, ImageKind kind, bool verify)
+    : path_(path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open image: " + path);
+    }
+    in.seekg(0, std::ios::end);
+    std::size_t bytes = static_cast<std::size_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+
+    ImageHeader h{};
+    if (bytes < sizeof(h) || !in.read(reinterpret_cast<char*>(&h), sizeof(h))) {
+        throw std::runtime_error("Image too short: " + path);
+    }
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0) {
+        throw std::runtime_error("Not an index image: " + path);
+    }
+    if (h.header_checksum != header_checksum(h)) {
+        throw std::runtime_error("Image header checksum mismatch: " + path);
+    }
+    if (h.version != kImageVersion) {
+        throw std::runtime_error("Unsupported image version " + std::to_string(h.version) +
+                                 " in " + path);
+    }
+    if (h.kind != static_cast<std::uint32_t>(kind)) {
+        throw std::runtime_error("Image holds a different index type: " + path);
+    }
+    if (h.file_bytes != bytes) {
+        throw std::runtime_error("Image size mismatch (truncated?): " + path);
+    }
+    size_ = bytes;
+
+#ifdef IMAGE_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        void* addr = ::mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr != MAP_FAILED) {
+            map_addr_ = addr;
+            data_ = static_cast<const char*>(addr);
+        }
+    }
+#endif
+    if (!data_) {
+        // Fallback: read into an owned, page-aligned buffer
+        owned_ = static_cast<char*>(::operator new(bytes, std::align_val_t(kBufferAlign)));
+        in.seekg(0, std::ios::beg);
+        if (!in.read(owned_, static_cast<std::streamsize>(bytes))) {
+            ::operator delete(owned_, std::align_val_t(kBufferAlign));
+            throw std::runtime_error("Failed to read image: " + path);
+        }
+        data_ = owned_;
+    }
+
+    if (verify) {
+        Checksum64 sum;
+        sum.update(data_ + sizeof(ImageHeader), size_ - sizeof(ImageHeader));
+        if (sum.digest() != h.payload_checksum) {
+            release();
+            throw std::runtime_error("Image payload checksum mismatch: " + path);
+        }
+    }
+}
+
+MappedImage::~MappedImage() {
+    release();
+}
+
+void MappedImage::release() {
+#ifdef IMAGE_HAVE_MMAP
+    if (map_addr_) ::munmap(map_addr_, size_);
+#endif
+    if (owned_) ::operator delete(owned_, std::align_val_t(kBufferAlign));
+    map_addr_ = nullptr;
+    owned_ = nullptr;
+}
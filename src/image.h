@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+// On-disk index images. An image is a 64-byte header followed by
+// kind-specific sections laid out exactly as the index uses them in
+// memory, so an opened image is queried in place through a read-only
+// mapping instead of being deserialised. Images are in native byte order
+// and only portable between machines of the same endianness.
+constexpr std::uint32_t kImageVersion = 1;
+
+enum class ImageKind : std::uint32_t { BPTree = 1, RMI = 2 };
+
+struct ImageHeader {
+    char magic[8];                    // "LIDXIMG\0"
+    std::uint32_t version;            // kImageVersion
+    std::uint32_t kind;               // ImageKind
+    std::uint64_t file_bytes;         // whole file, header included
+    std::uint64_t payload_checksum;   // Checksum64 of [sizeof(ImageHeader), file_bytes)
+    std::uint64_t header_checksum;    // Checksum64 of the header with this field 0
+    std::uint64_t reserved[3];
+};
+static_assert(sizeof(ImageHeader) == 64, "image header is one cache line");
+
+// Streaming 64-bit checksum: four multiply-rotate lanes over 8-byte words,
+// so long inputs hash at several bytes per cycle. Not cryptographic; it
+// catches torn writes and bit rot.
+class Checksum64 {
+public:
+    void update(const void* data, std::size_t bytes);
+    std::uint64_t digest() const;
+
+private:
+    std::uint64_t lanes_[4] = {0x9E3779B185EBCA87ull, 0xC2B2AE3D27D4EB4Full,
+                               0x165667B19E3779F9ull, 0x27D4EB2F165667C5ull};
+    std::uint64_t words_ = 0;
+    unsigned char tail_[8] = {};
+    std::size_t tail_len_ = 0;
+
+    void mix(std::uint64_t word);
+};
+
+// Writes an image to path + ".tmp" and renames it over path in finish(),
+// so readers never see a half-written image. Throws std::runtime_error on
+// I/O failure.
+class ImageWriter {
+public:
+    ImageWriter(const std::string& path, ImageKind kind);
+
+    void write(const void* data, std::size_t bytes);
+    // Zero-pad up to the next multiple of alignment (from file start)
+    void align(std::size_t alignment);
+    std::size_t offset() const { return offset_; }
+
+    void finish();
+
+private:
+    std::string path_;
+    std::string tmp_path_;
+    std::ofstream out_;
+    ImageKind kind_;
+    Checksum64 sum_;
+    std::size_t offset_;
+};
+
+// A read-only image: mapped when mmap is available, read into an aligned
+// buffer otherwise. The constructor checks magic, version, kind, file size
+// and the header checksum; verify also checks the payload checksum, which
+// reads the whole file. Any mismatch throws std::runtime_error.
+class MappedImage {
+public:
+    MappedImage(const std::string& path, ImageKind kind, bool verify = true);
+    ~MappedImage();
+
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    bool is_mapped() const { return map_addr_ != nullptr; }
+    bool contains(const void* p) const {
+        const char* c = static_cast<const char*>(p);
+        return c >= data_ && c < data_ + size_;
+    }
+
+    // count objects of type T at byte offset; throws std::runtime_error if
+    // they do not fit in the image or are misaligned
+    template <typename T>
+    const T* at(std::uint64_t offset, std::uint64_t count) const {
+        if (offset > size_ || count > (size_ - offset) / sizeof(T) ||
+            offset % alignof(T) != 0) {
+            throw std::runtime_error("image section out of bounds: " + path_);
+        }
+        return reinterpret_cast<const T*>(data_ + offset);
+    }
+
+private:
+    std::string path_;
+    void* map_addr_ = nullptr;
+    char* owned_ = nullptr;
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+
+    void release();
+};
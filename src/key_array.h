@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "memory.h"
+#include "span.h"
+
+// The sorted key array an index searches: either a view of keys owned by
+// the caller, which must outlive the index, or keys handed over to the
+// index. Not copyable, so no copy can end up viewing another object's
+// buffer; moving keeps the view valid because the buffer moves with it.
+class KeyArray {
+public:
+    KeyArray() = default;
+    KeyArray(const KeyArray&) = delete;
+    KeyArray& operator=(const KeyArray&) = delete;
+    KeyArray(KeyArray&&) = default;
+    KeyArray& operator=(KeyArray&&) = default;
+
+    // View caller-owned keys; drops owned keys unless keys points into them
+    void reference(KeySpan keys) {
+        const std::uint64_t* p = keys.data();
+        if (owned_.empty() || p < owned_.data() || p >= owned_.data() + owned_.size()) {
+            std::vector<std::uint64_t>().swap(owned_);
+        }
+        view_ = keys;
+    }
+
+    void own(std::vector<std::uint64_t>&& keys) {
+        owned_ = std::move(keys);
+        view_ = KeySpan(owned_);
+    }
+
+    KeySpan span() const { return view_; }
+    const std::uint64_t* data() const { return view_.data(); }
+    std::size_t size() const { return view_.size(); }
+    std::uint64_t operator[](std::size_t i) const { return view_[i]; }
+    bool owned() const { return !owned_.empty(); }
+
+    // Heap bytes of owned keys, 0 for a view
+    std::size_t heap_bytes() const { return vector_heap_bytes(owned_); }
+
+private:
+    std::vector<std::uint64_t> owned_;
+    KeySpan view_;
+};
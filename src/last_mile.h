@@ -0,0 +1,181 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "simd_search.h"
+#include "span.h"
+
+// Last-mile search strategies: how a lookup finds the key inside the
+// window its model predicted. All of them return the first position in
+// the window whose key is >= the search key.
+enum class LastMile {
+    Binary,          // std::lower_bound over the window
+    Branchless,      // branch-free binary search, prefetching the next probes
+    Exponential,     // gallop outward from the prediction, then binary search
+    Interpolation,   // a few interpolation steps on the key values, then binary
+    Linear,          // branch-free halving down to kLinearScanWindow keys, then
+                     // a SIMD count over what is left
+};
+
+constexpr std::size_t kLinearScanWindow = 64;
+
+inline const char* last_mile_name(LastMile m) {
+    switch (m) {
+    case LastMile::Binary:        return "binary";
+    case LastMile::Branchless:    return "branchless";
+    case LastMile::Exponential:   return "exponential";
+    case LastMile::Interpolation: return "interpolation";
+    case LastMile::Linear:        return "linear";
+    }
+    return "?";
+}
+
+// First position in [lo, end) with k[pos] >= key, end if none
+inline std::size_t branchless_lower_bound(const std::uint64_t* k, std::size_t lo,
+                                          std::size_t end, std::uint64_t key) {
+    std::size_t len = end - lo;
+    if (len == 0) return lo;
+    const std::uint64_t* base = k + lo;
+    while (len > 1) {
+        std::size_t half = len / 2;
+        __builtin_prefetch(base + half / 2);
+        __builtin_prefetch(base + half + half / 2);
+        base = (base[half] < key) ? base + half : base;
+        len -= half;
+    }
+    return static_cast<std::size_t>(base - k) + (*base < key);
+}
+
+inline std::size_t exponential_lower_bound(const std::uint64_t* k, std::size_t p,
+                                           std::size_t lo, std::size_t end,
+                                           std::uint64_t key) {
+    if (lo == end) return lo;
+    p = std::min(std::max(p, lo), end - 1);
+    std::size_t step = 1;
+    if (k[p] < key) {
+        // Answer in (p, end]
+        std::size_t left = p;
+        while (left + step < end && k[left + step] < key) {
+            left += step;
+            step *= 2;
+        }
+        return branchless_lower_bound(k, left + 1, std::min(left + step, end), key);
+    }
+    // Answer in [lo, p]
+    std::size_t right = p;
+    while (right >= lo + step && k[right - step] >= key) {
+        right -= step;
+        step *= 2;
+    }
+    std::size_t left = (right >= lo + step) ? right - step + 1 : lo;
+    return branchless_lower_bound(k, left, right, key);
+}
+
+inline std::size_t interpolation_lower_bound(const std::uint64_t* k, std::size_t lo,
+                                             std::size_t end, std::uint64_t key) {
+    // Answer in [lo, end]; interpolate while the range is worth it
+    for (int step = 0; step < 4 && end - lo > 16; ++step) {
+        std::uint64_t first = k[lo], last = k[end - 1];
+        if (key <= first) return lo;
+        if (key > last) return end;
+        double f = static_cast<double>(key - first) / static_cast<double>(last - first);
+        std::size_t mid = lo + static_cast<std::size_t>(f * static_cast<double>(end - 1 - lo));
+        if (k[mid] < key) lo = mid + 1;
+        else end = mid;
+    }
+    return branchless_lower_bound(k, lo, end, key);
+}
+
+inline std::size_t linear_lower_bound(const std::uint64_t* k, std::size_t lo,
+                                      std::size_t end, std::uint64_t key) {
+    const std::uint64_t* base = k + lo;
+    std::size_t len = end - lo;
+    while (len > kLinearScanWindow) {
+        std::size_t half = len / 2;
+        base = (base[half] < key) ? base + half : base;
+        len -= half;
+    }
+    // Keys < key are keys <= key - 1
+    std::size_t less = key == 0 ? 0 : count_le(base, len, key - 1);
+    return static_cast<std::size_t>(base - k) + less;
+}
+
+// First position in [lo, end) with k[pos] >= key, end if none; p is the
+// model's prediction, used as the starting point by Exponential
+inline std::size_t last_mile_search(LastMile m, const std::uint64_t* k, std::uint64_t key,
+                                     std::size_t p, std::size_t lo, std::size_t end) {
+    switch (m) {
+    case LastMile::Branchless:    return branchless_lower_bound(k, lo, end, key);
+    case LastMile::Exponential:   return exponential_lower_bound(k, p, lo, end, key);
+    case LastMile::Interpolation: return interpolation_lower_bound(k, lo, end, key);
+    case LastMile::Linear:        return linear_lower_bound(k, lo, end, key);
+    case LastMile::Binary:        break;
+    }
+    return std::lower_bound(k + lo, k + end, key) - k;
+}
+
+// Half-open window [lo, end) for a model's prediction p, given the signed
+// errors (true - predicted position) seen in training, clipped to the
+// model's run [start, stop). Always start <= lo <= end <= stop.
+inline void error_window(std::size_t p, std::int64_t min_error, std::int64_t max_error,
+                         std::size_t start, std::size_t stop,
+                         std::size_t& lo, std::size_t& end) {
+    std::int64_t first = static_cast<std::int64_t>(p) + min_error;
+    std::int64_t last = static_cast<std::int64_t>(p) + max_error + 1;
+    lo = first <= static_cast<std::int64_t>(start) ? start
+       : std::min(static_cast<std::size_t>(first), stop);
+    end = last >= static_cast<std::int64_t>(stop) ? stop
+        : std::max(static_cast<std::size_t>(std::max<std::int64_t>(last, 0)), lo);
+}
+
+// Largest window error_window() yields for a run of len keys
+inline std::size_t window_size(std::int64_t min_error, std::int64_t max_error,
+                               std::size_t len) {
+    return std::min(len, static_cast<std::size_t>(max_error - min_error) + 1);
+}
+
+// Count `keys` keys with a window of `size` positions into log2 bucket
+// hist[floor(log2(size))], growing hist as needed
+inline void add_window(std::vector<std::size_t>& hist, std::size_t size, std::size_t keys) {
+    std::size_t b = 0;
+    while (size >> (b + 1)) ++b;
+    if (hist.size() <= b) hist.resize(b + 1, 0);
+    hist[b] += keys;
+}
+
+// Position of the first key >= key in keys, searching the half-open window
+// [lo, end) first with strategy m. A model's error bound only covers keys
+// seen in training, so an answer on the window edge is checked and the
+// search gallops outward when the window missed it. Requires
+// lo <= end <= size.
+inline std::size_t window_lower_bound(KeySpan keys, std::uint64_t key,
+                                      std::size_t lo, std::size_t end,
+                                      LastMile m = LastMile::Binary,
+                                      std::size_t p = 0) {
+    std::size_t n = keys.size();
+    const std::uint64_t* k = keys.data();
+    std::size_t pos = last_mile_search(m, k, key, p, lo, end);
+
+    if (pos == lo && lo > 0 && k[lo - 1] >= key) {
+        // Answer is left of the window: gallop down from lo - 1
+        std::size_t right = lo - 1, step = 1;
+        while (right >= step && k[right - step] >= key) {
+            right -= step;
+            step *= 2;
+        }
+        std::size_t left = (right >= step) ? right - step + 1 : 0;
+        pos = std::lower_bound(k + left, k + right, key) - k;
+    } else if (pos == end && end < n && k[end] < key) {
+        // Answer is right of the window: gallop up from end
+        std::size_t left = end, step = 1;
+        while (left + step < n && k[left + step] < key) {
+            left += step;
+            step *= 2;
+        }
+        std::size_t right = std::min(left + step, n);
+        pos = std::lower_bound(k + left + 1, k + right, key) - k;
+    }
+    return pos;
+}
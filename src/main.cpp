@@ -1,17 +1,36 @@
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <numeric>
 #include <random>
+#include <shared_mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#endif
+
 #include "rmi.h"
 #include "bpt.h"
+#include "simd_search.h"
+#include "staged_rmi.h"
+#include "memory.h"
+#include "dataset.h"
+#include "delta_rmi.h"
+#include "gapped_rmi.h"
+#include "timing.h"
+#include "tuner.h"
 
 using std::cout;
 using std::cerr;
@@ -19,29 +38,8 @@ using std::endl;
 
 // ------------- Data loading & query generation -------------
 
-// Load uint64_t keys from a binary file
-std::vector<std::uint64_t> load_dataset(const std::string& path, std::size_t max_keys = 0) {
-    std::ifstream in(path, std::ios::binary);
-    if (!in) {
-        throw std::runtime_error("Cannot open file: " + path);
-    }
-    in.seekg(0, std::ios::end);
-    std::size_t bytes = static_cast<std::size_t>(in.tellg());
-    in.seekg(0, std::ios::beg);
-    std::size_t total = bytes / sizeof(std::uint64_t);
-    if (max_keys > 0 && max_keys < total) {
-        total = max_keys;
-    }
-    std::vector<std::uint64_t> keys(total);
-    in.read(reinterpret_cast<char*>(keys.data()), total * sizeof(std::uint64_t));
-    if (!in) {
-        throw std::runtime_error("Failed to read file: " + path);
-    }
-    return keys;
-}
-
 // Sample queries uniformly from existing keys
-std::vector<std::uint64_t> generate_queries(const std::vector<std::uint64_t>& keys,
+std::vector<std::uint64_t> generate_queries(KeySpan keys,
                                             std::size_t num_queries) {
     std::mt19937_64 rng(42);
     std::uniform_int_distribution<std::size_t> dist(0, keys.size() - 1);
@@ -53,6 +51,25 @@ std::vector<std::uint64_t> generate_queries(const std::vector<std::uint64_t>& ke
     return qs;
 }
 
+// Range queries [lo, hi) covering about `selectivity` keys each, starting
+// at uniformly sampled key positions
+std::vector<std::pair<std::uint64_t, std::uint64_t>>
+generate_ranges(KeySpan keys, std::size_t selectivity, std::size_t num_ranges) {
+    std::mt19937_64 rng(7);
+    std::size_t n = keys.size();
+    std::size_t last_start = n > selectivity ? n - selectivity - 1 : 0;
+    std::uniform_int_distribution<std::size_t> dist(0, last_start);
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;
+    ranges.reserve(num_ranges);
+    for (std::size_t i = 0; i < num_ranges; ++i) {
+        std::size_t start = dist(rng);
+        std::size_t end = start + selectivity;
+        std::uint64_t hi = end < n ? keys[end] : ~std::uint64_t(0);
+        ranges.emplace_back(keys[start], hi);
+    }
+    return ranges;
+}
+
 // ------------- Stats & benchmarking -------------
 
 struct Stats {
@@ -76,9 +93,11 @@ Stats compute_stats(std::vector<long long>& latencies_ns) {
     return {mean, p95, p99};
 }
 
-Stats benchmark_bpt(const std::vector<std::uint64_t>& keys,
-                    BPTree& tree,
-                    const std::vector<std::uint64_t>& queries) {
+// Legacy mode: one steady_clock pair around every lookup. The timer cost
+// and its serialising effect dominate at tens of nanoseconds per lookup;
+// kept as metric "lookup_clock" to compare against.
+template <typename Lookup>
+Stats benchmark_clock(const std::vector<std::uint64_t>& queries, Lookup lookup) {
     std::vector<long long> latencies;
     latencies.reserve(queries.size());
     using clock = std::chrono::high_resolution_clock;
@@ -86,7 +105,7 @@ Stats benchmark_bpt(const std::vector<std::uint64_t>& keys,
     for (auto q : queries) {
         auto t0 = clock::now();
         std::size_t pos = 0;
-        bool ok = tree.search(q, pos);
+        bool ok = lookup(q, pos);
         auto t1 = clock::now();
         auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
         latencies.push_back(ns);
@@ -95,28 +114,715 @@ Stats benchmark_bpt(const std::vector<std::uint64_t>& keys,
     return compute_stats(latencies);
 }
 
-Stats benchmark_rmi(const std::vector<std::uint64_t>& keys,
-                    RMI& rmi,
-                    const std::vector<std::uint64_t>& queries) {
-    std::vector<long long> latencies;
-    latencies.reserve(queries.size());
+// Batched mode: the mean comes from timing whole batches of lookups with
+// the TSC, minus the cost of the same loop with an empty body. p95/p99
+// come from individually timed samples (every sample_every-th query),
+// minus the cost of an empty timed region.
+template <typename Lookup>
+Stats benchmark_lookup(const std::vector<std::uint64_t>& queries, Lookup lookup,
+                       std::size_t batch = 1000, std::size_t sample_every = 16) {
+    const std::size_t n = queries.size();
+    if (n == 0) return {0, 0, 0};
+    const double ns_per_tick = tsc_ns_per_tick();
+
+    auto timed_batches = [&](auto&& body) {
+        std::uint64_t ticks = 0;
+        for (std::size_t b = 0; b < n; b += batch) {
+            std::size_t e = std::min(b + batch, n);
+            std::uint64_t t0 = tsc_begin();
+            for (std::size_t i = b; i < e; ++i) body(queries[i]);
+            std::uint64_t t1 = tsc_end();
+            ticks += t1 - t0;
+        }
+        return ticks;
+    };
+
+    std::size_t sink = 0;
+    std::uint64_t empty_ticks = timed_batches([&](std::uint64_t q) {
+        do_not_optimize(q);
+    });
+    std::uint64_t lookup_ticks = timed_batches([&](std::uint64_t q) {
+        std::size_t pos = 0;
+        bool ok = lookup(q, pos);
+        sink += ok ? pos : 0;
+    });
+    do_not_optimize(sink);
+    double net = static_cast<double>(lookup_ticks) - static_cast<double>(empty_ticks);
+    double mean_ns = std::max(0.0, net) * ns_per_tick / static_cast<double>(n);
+
+    // Cost of an empty timed region: the minimum is the best estimate
+    std::uint64_t timer_ticks = ~std::uint64_t(0);
+    for (int i = 0; i < 1000; ++i) {
+        std::uint64_t t0 = tsc_begin();
+        std::uint64_t t1 = tsc_end();
+        timer_ticks = std::min(timer_ticks, t1 - t0);
+    }
+
+    std::vector<long long> samples;
+    samples.reserve(n / sample_every + 1);
+    for (std::size_t i = 0; i < n; i += sample_every) {
+        std::size_t pos = 0;
+        std::uint64_t t0 = tsc_begin();
+        bool ok = lookup(queries[i], pos);
+        std::uint64_t t1 = tsc_end();
+        do_not_optimize(ok);
+        std::uint64_t ticks = t1 - t0;
+        ticks = ticks > timer_ticks ? ticks - timer_ticks : 0;
+        samples.push_back(static_cast<long long>(ticks));
+    }
+    Stats tail = compute_stats(samples);
+    return {mean_ns, tail.p95_ns * ns_per_tick, tail.p99_ns * ns_per_tick};
+}
+
+// Batched lookup API: mean ns per key when queries are resolved through
+// search_batch in chunks of batch_size, TSC-timed over the whole workload.
+template <typename BatchLookup>
+double benchmark_batch(const std::vector<std::uint64_t>& queries,
+                       std::size_t batch_size, BatchLookup lookup_batch) {
+    std::size_t n = queries.size();
+    if (n == 0) return 0.0;
+    std::vector<std::size_t> out(batch_size);
+    std::unique_ptr<bool[]> found(new bool[batch_size]);
+
+    std::uint64_t t0 = tsc_begin();
+    for (std::size_t b = 0; b < n; b += batch_size) {
+        std::size_t e = std::min(b + batch_size, n);
+        lookup_batch(KeySpan(queries.data() + b, e - b),
+                     Span<std::size_t>(out.data(), e - b),
+                     Span<bool>(found.get(), e - b));
+        do_not_optimize(out[0]);
+    }
+    std::uint64_t t1 = tsc_end();
+    return static_cast<double>(t1 - t0) * tsc_ns_per_tick() / static_cast<double>(n);
+}
+
+// Range scans: TSC-timed over all ranges. scan(lo, hi) returns the number
+// of keys it visited.
+struct RangeStats {
+    double ns_per_range;
+    double mkeys_per_s;
+};
+
+template <typename Scan>
+RangeStats benchmark_range(const std::vector<std::pair<std::uint64_t, std::uint64_t>>& ranges,
+                           Scan scan) {
+    if (ranges.empty()) return {0, 0};
+    std::size_t visited = 0;
+    std::uint64_t t0 = tsc_begin();
+    for (const auto& r : ranges) {
+        visited += scan(r.first, r.second);
+    }
+    std::uint64_t t1 = tsc_end();
+    do_not_optimize(visited);
+    double ns = static_cast<double>(t1 - t0) * tsc_ns_per_tick();
+    return {ns / static_cast<double>(ranges.size()),
+            ns > 0 ? static_cast<double>(visited) / ns * 1e3 : 0.0};
+}
+
+// ------------- Multi-threaded throughput -------------
+
+// Pin the calling thread to one CPU (no-op where unsupported)
+void pin_to_cpu(unsigned cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+// 1, 2, 4, ... up to and including the number of hardware threads
+std::vector<unsigned> thread_counts() {
+    unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> counts;
+    for (unsigned t = 1; t < hw; t *= 2) counts.push_back(t);
+    counts.push_back(hw);
+    return counts;
+}
+
+// Run the shared query workload on `threads` pinned threads; each thread
+// does `rounds` passes over all queries, starting at its own offset.
+// Returns aggregate lookups per second in millions.
+template <typename Lookup>
+double benchmark_throughput(unsigned threads,
+                            const std::vector<std::uint64_t>& queries,
+                            std::size_t rounds,
+                            Lookup lookup) {
+    using clock = std::chrono::steady_clock;
+    std::atomic<unsigned> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<std::size_t> sink{0};
+    unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            pin_to_cpu(t % hw);
+            std::size_t n = queries.size();
+            std::size_t start = n * t / threads;
+            std::size_t acc = 0;
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {}
+            for (std::size_t r = 0; r < rounds; ++r) {
+                for (std::size_t i = 0; i < n; ++i) {
+                    std::size_t pos = 0;
+                    if (lookup(queries[(start + i) % n], pos)) acc += pos;
+                }
+            }
+            sink.fetch_add(acc);
+        });
+    }
+    while (ready.load() != threads) {}
+    auto t0 = clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& w : workers) w.join();
+    auto t1 = clock::now();
+
+    std::chrono::duration<double> dt = t1 - t0;
+    double ops = static_cast<double>(threads) * rounds * queries.size();
+    return ops / dt.count() / 1e6;
+}
+
+// ------------- RMI model sweep -------------
+
+// Train one RMI configuration and record train time, model bytes and
+// lookup latency
+template <typename Index>
+void benchmark_models(const std::string& name, KeySpan keys,
+                      const std::vector<std::uint64_t>& queries,
+                      std::size_t leaves, std::ostream& csv) {
     using clock = std::chrono::high_resolution_clock;
+    Index rmi(leaves);
+    auto t0 = clock::now();
+    rmi.train(keys);
+    auto t1 = clock::now();
+    double train_time = std::chrono::duration<double>(t1 - t0).count();
+    MemoryUsage mem = rmi.memory_usage();
+    auto stats = benchmark_lookup(queries,
+        [&](std::uint64_t q, std::size_t& pos) { return rmi.search(q, pos); });
 
-    for (auto q : queries) {
-        auto t0 = clock::now();
+    cout << "RMI(" << leaves << ") " << Index::model_name() << ": train "
+         << train_time << " s, mem " << mem.index_bytes / 1024.0
+         << " KB, lookup mean=" << stats.mean_ns << " ns" << endl;
+    csv << name << "," << Index::root_model_name() << ","
+        << Index::leaf_model_name() << ","
+        << keys.size() << "," << leaves << ","
+        << train_time << "," << mem.index_bytes << ","
+        << stats.mean_ns << "," << stats.p95_ns << "," << stats.p99_ns << "\n";
+}
+
+// Last-mile window sizes of an RMI's trained keys, one row per log2
+// bucket; prints the median and 99th percentile bucket
+void report_windows(const std::string& name, const std::string& index_name,
+                    const std::string& config, const std::vector<std::size_t>& hist,
+                    std::size_t num_keys, std::ostream& csv) {
+    std::size_t seen = 0, p50 = 0, p99 = 0;
+    for (std::size_t b = 0; b < hist.size(); ++b) {
+        if (hist[b] == 0) continue;
+        csv << name << "," << index_name << "," << config << ","
+            << (std::size_t(1) << b) << "," << (std::size_t(2) << b) - 1 << ","
+            << hist[b] << "," << static_cast<double>(hist[b]) / num_keys << "\n";
+        if (seen < num_keys / 2) p50 = b;
+        if (seen < num_keys - num_keys / 100) p99 = b;
+        seen += hist[b];
+    }
+    cout << index_name << " " << config << " windows: p50 < " << (std::size_t(2) << p50)
+         << ", p99 < " << (std::size_t(2) << p99) << " positions" << endl;
+}
+
+// Train an RMI with any number of stages and record memory, mean log2
+// window and lookup latency
+template <typename Index>
+void benchmark_staged(const std::string& name, const std::string& index_name,
+                      const std::string& stages, Index& rmi, KeySpan keys,
+                      const std::vector<std::uint64_t>& queries, std::ostream& csv,
+                      std::ostream& windows) {
+    using clock = std::chrono::high_resolution_clock;
+    auto t0 = clock::now();
+    rmi.train(keys);
+    auto t1 = clock::now();
+    double train_time = std::chrono::duration<double>(t1 - t0).count();
+    MemoryUsage mem = rmi.memory_usage();
+    auto stats = benchmark_lookup(queries,
+        [&](std::uint64_t q, std::size_t& pos) { return rmi.search(q, pos); });
+
+    cout << index_name << " " << stages << ": mem " << mem.index_bytes / 1024.0
+         << " KB, log2 window " << rmi.mean_log2_window()
+         << ", lookup mean=" << stats.mean_ns << " ns, p99=" << stats.p99_ns
+         << " ns" << endl;
+    report_windows(name, index_name, stages, rmi.window_histogram(), keys.size(), windows);
+    csv << name << "," << index_name << "," << stages << ","
+        << keys.size() << "," << mem.index_bytes << "," << train_time << ","
+        << rmi.mean_log2_window() << ","
+        << stats.mean_ns << "," << stats.p95_ns << "," << stats.p99_ns << "\n";
+}
+
+// ------------- Startup: rebuild vs open -------------
+
+// Time until an index can answer queries: load the dataset file and build
+// (rebuild), or open the image of ref saved at image_path, with and
+// without checksum verification. lookup_mean_ns is the first pass over
+// the queries right after startup, so a mapped image pays its page faults
+// there. Every started index must answer as ref does.
+template <typename Index, typename Make, typename Build>
+void benchmark_startup(const std::string& name, const std::string& index_name,
+                       const std::string& data_path, std::size_t max_keys,
+                       const DatasetOptions& load_opts, const Index& ref,
+                       const std::string& image_path,
+                       const std::vector<std::uint64_t>& queries,
+                       Make make, Build build, std::ostream& csv) {
+    using clock = std::chrono::high_resolution_clock;
+    auto t0 = clock::now();
+    ref.save(image_path);
+    auto t1 = clock::now();
+    std::size_t image_bytes = static_cast<std::size_t>(
+        std::ifstream(image_path, std::ios::binary | std::ios::ate).tellg());
+    cout << index_name << " image: " << image_bytes / 1024.0 / 1024.0 << " MB, saved in "
+         << std::chrono::duration<double>(t1 - t0).count() << " s" << endl;
+
+    auto run = [&](const char* method, auto&& start) {
+        auto s0 = clock::now();
+        Index idx = make();
+        auto keep = start(idx);   // whatever must outlive the index
+        auto s1 = clock::now();
+        double time_s = std::chrono::duration<double>(s1 - s0).count();
+        auto stats = benchmark_lookup(queries,
+            [&](std::uint64_t q, std::size_t& pos) { return idx.search(q, pos); });
+        for (std::uint64_t q : queries) {
+            std::size_t p1 = 0, p2 = 0;
+            if (idx.search(q, p1) != ref.search(q, p2) || p1 != p2) {
+                cerr << "[SANITY] " << index_name << " " << method
+                     << " answers differ for key " << q << "\n";
+                break;
+            }
+        }
+        cout << index_name << " " << method << ": " << time_s << " s, first lookups mean="
+             << stats.mean_ns << " ns" << endl;
+        csv << name << "," << index_name << "," << method << "," << time_s << ","
+            << (idx.is_mapped() ? image_bytes : 0) << "," << stats.mean_ns << "\n";
+        (void)keep;
+    };
+
+    run("rebuild", [&](Index& idx) {
+        auto data = std::make_unique<Dataset>(data_path, max_keys, load_opts);
+        build(idx, data->keys());
+        return data;
+    });
+    run("open", [&](Index& idx) {
+        idx.open(image_path, false);
+        return 0;
+    });
+    run("open_verify", [&](Index& idx) {
+        idx.open(image_path, true);
+        return 0;
+    });
+}
+
+// ------------- Updates -------------
+
+// Keys for the update workloads: at most max_keys, sampled evenly and
+// without repeats; every other one is bulk-loaded (base) and the rest are
+// inserted later, in random order (pending, with their positions in keys)
+struct UpdateKeys {
+    std::vector<std::uint64_t> base;
+    std::vector<std::uint64_t> pending;
+    std::vector<std::size_t> pending_pos;
+};
+
+UpdateKeys split_update_keys(KeySpan keys, std::size_t max_keys) {
+    UpdateKeys u;
+    std::size_t stride = std::max<std::size_t>(1, (keys.size() + max_keys - 1) / max_keys);
+    std::vector<std::size_t> positions;
+    for (std::size_t i = 0, j = 0; i < keys.size(); i += stride) {
+        // A run of duplicates could otherwise put one key in both halves
+        if (j > 0 && keys[i] == keys[i - stride]) continue;
+        if (j++ % 2 == 0) {
+            u.base.push_back(keys[i]);
+        } else {
+            positions.push_back(i);
+        }
+    }
+    std::shuffle(positions.begin(), positions.end(), std::mt19937_64(11));
+    for (std::size_t i : positions) {
+        u.pending.push_back(keys[i]);
+        u.pending_pos.push_back(i);
+    }
+    return u;
+}
+
+// The base keys of u with as many new pending keys, in order, continuing
+// past the largest base key (append) or below the smallest (prepend) at
+// the base's average gap; fewer if the key range runs out
+UpdateKeys edge_update_keys(const UpdateKeys& u, bool append) {
+    UpdateKeys e;
+    e.base = u.base;
+    if (u.base.size() < 2) return e;
+    std::uint64_t gap = std::max<std::uint64_t>(
+        1, (u.base.back() - u.base.front()) / (u.base.size() - 1));
+    std::uint64_t room = append ? ~std::uint64_t(0) - u.base.back() : u.base.front();
+    std::size_t n = static_cast<std::size_t>(
+        std::min<std::uint64_t>(u.pending.size(), room / gap));
+    for (std::size_t i = 1; i <= n; ++i) {
+        e.pending.push_back(append ? u.base.back() + i * gap : u.base.front() - i * gap);
+        e.pending_pos.push_back(u.base.size() + i - 1);
+    }
+    return e;
+}
+
+// A B+Tree aging under inserts: bulk-load the base keys at fill_factor,
+// insert the pending ones over `phases` phases and erase them again over
+// as many. After each phase, lookups of the base keys show how the
+// tree's shape (split, half-full and reused nodes) changes lookup latency.
+void benchmark_updates(const std::string& name, const UpdateKeys& u, double fill_factor,
+                       std::size_t phases, std::size_t num_queries, std::ostream& csv) {
+    using clock = std::chrono::high_resolution_clock;
+    const auto& base = u.base;
+    const auto& pending = u.pending;
+    auto queries = generate_queries(base, num_queries);
+
+    BPTree tree(64, fill_factor);
+    auto t0 = clock::now();
+    tree.bulk_load(base);
+    auto t1 = clock::now();
+    std::size_t tree_keys = base.size();
+
+    auto report = [&](std::size_t phase, const char* op, double mops) {
+        auto stats = benchmark_lookup(queries,
+            [&](std::uint64_t q, std::size_t& pos) { return tree.search(q, pos); });
+        std::size_t index_bytes = tree.memory_usage().index_bytes;
+        cout << "B+Tree(fill " << fill_factor << ") " << op << " phase " << phase
+             << ": " << tree_keys << " keys, " << mops << " Mops, lookup mean="
+             << stats.mean_ns << " ns, p99=" << stats.p99_ns << " ns, "
+             << index_bytes / 1024.0 / 1024.0 << " MB" << endl;
+        csv << name << "," << fill_factor << "," << phase << "," << op << ","
+            << tree_keys << "," << mops << "," << stats.mean_ns << ","
+            << stats.p99_ns << "," << index_bytes << "\n";
+    };
+    report(0, "bulk_load",
+           base.size() / std::chrono::duration<double>(t1 - t0).count() / 1e6);
+
+    // Phase p handles pending[lo(p), lo(p + 1))
+    auto lo = [&](std::size_t p) { return pending.size() * p / phases; };
+    for (std::size_t p = 0; p < phases; ++p) {
+        auto s0 = clock::now();
+        for (std::size_t i = lo(p); i < lo(p + 1); ++i) {
+            tree_keys += tree.insert(pending[i], u.pending_pos[i]);
+        }
+        auto s1 = clock::now();
+        double secs = std::chrono::duration<double>(s1 - s0).count();
+        report(p + 1, "insert", (lo(p + 1) - lo(p)) / secs / 1e6);
+    }
+    for (std::size_t p = 0; p < phases; ++p) {
+        auto s0 = clock::now();
+        for (std::size_t i = lo(p); i < lo(p + 1); ++i) {
+            tree_keys -= tree.erase(pending[i]);
+        }
+        auto s1 = clock::now();
+        double secs = std::chrono::duration<double>(s1 - s0).count();
+        report(phases + p + 1, "erase", (lo(p + 1) - lo(p)) / secs / 1e6);
+    }
+}
+
+// Read/write mix on an updatable index: bulk-load the base keys, then run
+// num_ops operations, of which write_fraction insert the next pending key
+// and the rest look up a random key present at that point. Operations are
+// drawn up front, so the timed loop runs only index calls. Lookup latency
+// of the base keys is measured on the resulting index.
+template <typename Index>
+void benchmark_mix(const std::string& name, const std::string& index_name, Index& index,
+                   const UpdateKeys& u, const std::string& mix, double write_fraction,
+                   std::size_t num_ops, std::size_t num_queries, std::ostream& csv) {
+    using clock = std::chrono::high_resolution_clock;
+    if (write_fraction > 0.0) {
+        num_ops = std::min(num_ops, static_cast<std::size_t>(
+                                        static_cast<double>(u.pending.size()) / write_fraction));
+    }
+    struct Op {
+        std::uint64_t key;
+        std::size_t value;
+        bool insert;
+    };
+    std::vector<Op> ops;
+    ops.reserve(num_ops);
+    std::vector<std::uint64_t> present = u.base;
+    std::mt19937_64 rng(13);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    std::size_t next = 0;
+    for (std::size_t i = 0; i < num_ops; ++i) {
+        if (coin(rng) < write_fraction && next < u.pending.size()) {
+            ops.push_back({u.pending[next], u.pending_pos[next], true});
+            present.push_back(u.pending[next++]);
+        } else {
+            ops.push_back({present[rng() % present.size()], 0, false});
+        }
+    }
+
+    index.bulk_load(u.base);
+    std::size_t missed = 0;
+    auto t0 = clock::now();
+    for (const Op& op : ops) {
+        if (op.insert) {
+            index.insert(op.key, op.value);
+        } else {
+            std::size_t pos = 0;
+            missed += !index.search(op.key, pos);
+        }
+    }
+    auto t1 = clock::now();
+    if (missed > 0) {
+        cerr << "[SANITY] " << index_name << " " << mix << ": " << missed
+             << " lookups missed\n";
+    }
+    double mops = ops.size() / std::chrono::duration<double>(t1 - t0).count() / 1e6;
+
+    auto queries = generate_queries(u.base, num_queries);
+    auto stats = benchmark_lookup(queries,
+        [&](std::uint64_t q, std::size_t& pos) { return index.search(q, pos); });
+    std::size_t index_bytes = index.memory_usage().index_bytes;
+    cout << index_name << " " << mix << " (" << write_fraction * 100 << "% inserts): "
+         << mops << " Mops, then lookup mean=" << stats.mean_ns << " ns, p99="
+         << stats.p99_ns << " ns, " << index_bytes / 1024.0 / 1024.0 << " MB";
+    if constexpr (std::is_same<Index, GappedRMI>::value) {
+        const GappedRMI::Stats& st = index.stats();
+        cout << ", " << index.num_leaves() << " leaves (" << st.expansions
+             << " expansions, " << st.splits << " splits, " << st.retrains << " retrains, "
+             << st.root_extensions << " root extensions)";
+    }
+    cout << endl;
+    csv << name << "," << index_name << "," << mix << "," << write_fraction << ","
+        << ops.size() << "," << mops << "," << stats.mean_ns << "," << stats.p99_ns << ","
+        << index_bytes << "\n";
+}
+
+// Readers alongside an active writer: `readers` pinned threads make
+// `rounds` passes over lookups of base keys, while one more thread inserts
+// the pending keys and erases them again until the readers are done.
+// With kGlobalLock every call takes one std::shared_mutex (shared for
+// lookups, exclusive for writes) instead of relying on the tree's own
+// optimistic lock coupling.
+template <bool kGlobalLock>
+void benchmark_concurrent(const std::string& name, const UpdateKeys& u, double fill_factor,
+                          unsigned readers, const std::vector<std::uint64_t>& queries,
+                          std::size_t rounds, std::ostream& csv) {
+    using clock = std::chrono::steady_clock;
+    const char* scheme = kGlobalLock ? "shared_mutex" : "olc";
+    BPTree tree(64, fill_factor);
+    tree.bulk_load(u.base);
+    std::shared_mutex global;
+
+    auto lookup = [&](std::uint64_t q, std::size_t& pos) {
+        if constexpr (kGlobalLock) {
+            std::shared_lock<std::shared_mutex> lock(global);
+            return tree.search(q, pos);
+        }
+        return tree.search(q, pos);
+    };
+    auto write = [&](auto op) {
+        if constexpr (kGlobalLock) {
+            std::unique_lock<std::shared_mutex> lock(global);
+            op();
+        } else {
+            op();
+        }
+    };
+
+    std::atomic<unsigned> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<unsigned> running{readers};
+    std::atomic<std::size_t> missed{0};
+    std::size_t writes = 0;
+    unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < readers; ++t) {
+        threads.emplace_back([&, t] {
+            pin_to_cpu(t % hw);
+            std::size_t n = queries.size();
+            std::size_t start = n * t / readers;
+            std::size_t miss = 0;
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {}
+            for (std::size_t r = 0; r < rounds; ++r) {
+                for (std::size_t i = 0; i < n; ++i) {
+                    std::size_t pos = 0;
+                    miss += !lookup(queries[(start + i) % n], pos);
+                }
+            }
+            missed.fetch_add(miss);
+            running.fetch_sub(1, std::memory_order_release);
+        });
+    }
+    threads.emplace_back([&] {
+        pin_to_cpu(readers % hw);
+        ready.fetch_add(1);
+        while (!go.load(std::memory_order_acquire)) {}
+        // Insert every pending key, erase them all, repeat
+        for (bool inserting = true; running.load(std::memory_order_acquire) > 0;
+             inserting = !inserting) {
+            for (std::size_t i = 0; i < u.pending.size() &&
+                                    running.load(std::memory_order_relaxed) > 0; ++i) {
+                if (inserting) {
+                    write([&] { tree.insert(u.pending[i], u.pending_pos[i]); });
+                } else {
+                    write([&] { tree.erase(u.pending[i]); });
+                }
+                ++writes;
+            }
+        }
+    });
+    while (ready.load() != readers + 1) {}
+    auto t0 = clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& th : threads) th.join();
+    auto t1 = clock::now();
+
+    if (missed > 0) {
+        cerr << "[SANITY] BPTree " << scheme << ": " << missed << " lookups missed\n";
+    }
+    double secs = std::chrono::duration<double>(t1 - t0).count();
+    double read_mops = static_cast<double>(readers) * rounds * queries.size() / secs / 1e6;
+    double write_mops = writes / secs / 1e6;
+    cout << "B+Tree " << scheme << ", " << readers << " readers + 1 writer: "
+         << read_mops << " Mops reads, " << write_mops << " Mops writes" << endl;
+    csv << name << "," << scheme << "," << readers << "," << read_mops << ","
+        << write_mops << "\n";
+}
+
+// ------------- Delta-buffered RMI -------------
+
+// Merge cost vs delta size: bulk-load the base keys, insert delta_size
+// pending ones into the delta, then merge once. Lookups of the base keys
+// are timed with the delta full (they check it first) and after the merge.
+// Skipped if there are fewer than delta_size pending keys.
+void benchmark_delta_merge(const std::string& name, const UpdateKeys& u, std::size_t leaves,
+                           std::size_t delta_size, std::size_t num_queries, std::ostream& csv) {
+    if (delta_size == 0 || delta_size > u.pending.size()) return;
+    auto queries = generate_queries(u.base, num_queries);
+    auto lookup_mean = [&](DeltaRMI& index) {
+        return benchmark_lookup(queries,
+            [&](std::uint64_t q, std::size_t& pos) { return index.search(q, pos); }).mean_ns;
+    };
+
+    DeltaRMI index(leaves);
+    index.bulk_load(u.base);
+    for (std::size_t i = 0; i < delta_size; ++i) index.insert(u.pending[i], u.pending_pos[i]);
+    double before_ns = lookup_mean(index);
+    index.merge();
+    double after_ns = lookup_mean(index);
+    double secs = index.merge_stats().last_seconds;
+
+    std::size_t merged_keys = u.base.size() + delta_size;
+    cout << "DeltaRMI merge of " << delta_size << " into " << u.base.size() << " keys: "
+         << secs * 1e3 << " ms (" << merged_keys / secs / 1e6 << " Mkeys/s), lookup "
+         << before_ns << " -> " << after_ns << " ns" << endl;
+    csv << name << "," << leaves << "," << u.base.size() << "," << delta_size << ","
+        << secs << "," << before_ns << "," << after_ns << "\n";
+}
+
+// Lookup latency while background merges run: bulk-load the base keys
+// and merge whenever the delta reaches threshold entries, then run
+// num_ops operations, of which write_fraction insert the next pending key
+// and the rest look up a random present key. Every lookup is TSC-timed
+// and filed under whether a merge was running when it started.
+void benchmark_delta_latency(const std::string& name, const UpdateKeys& u, std::size_t leaves,
+                             std::size_t threshold, double write_fraction,
+                             std::size_t num_ops, std::ostream& csv) {
+    struct Op {
+        std::uint64_t key;
+        std::size_t value;
+        bool insert;
+    };
+    std::vector<Op> ops;
+    ops.reserve(num_ops);
+    std::vector<std::uint64_t> present = u.base;
+    std::mt19937_64 rng(17);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+    std::size_t next = 0;
+    for (std::size_t i = 0; i < num_ops; ++i) {
+        if (coin(rng) < write_fraction && next < u.pending.size()) {
+            ops.push_back({u.pending[next], u.pending_pos[next], true});
+            present.push_back(u.pending[next++]);
+        } else {
+            ops.push_back({present[rng() % present.size()], 0, false});
+        }
+    }
+
+    DeltaRMI index(leaves);
+    index.bulk_load(u.base);
+    index.start_background_merge(threshold);
+
+    std::uint64_t timer_ticks = ~std::uint64_t(0);
+    for (int i = 0; i < 1000; ++i) {
+        std::uint64_t t0 = tsc_begin();
+        std::uint64_t t1 = tsc_end();
+        timer_ticks = std::min(timer_ticks, t1 - t0);
+    }
+    std::vector<long long> ticks[2];   // [merge running]
+    ticks[0].reserve(ops.size());
+    std::size_t missed = 0;
+    for (const Op& op : ops) {
+        if (op.insert) {
+            index.insert(op.key, op.value);
+            continue;
+        }
+        bool merging = index.merging();
         std::size_t pos = 0;
-        bool ok = rmi.search(keys, q, pos);
-        auto t1 = clock::now();
-        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
-        latencies.push_back(ns);
-        (void)ok;
+        std::uint64_t t0 = tsc_begin();
+        bool ok = index.search(op.key, pos);
+        std::uint64_t t1 = tsc_end();
+        missed += !ok;
+        std::uint64_t dt = t1 - t0;
+        ticks[merging].push_back(static_cast<long long>(dt > timer_ticks ? dt - timer_ticks : 0));
     }
-    return compute_stats(latencies);
+    index.stop_background_merge();
+    if (missed > 0) {
+        cerr << "[SANITY] DeltaRMI: " << missed << " lookups missed\n";
+    }
+
+    DeltaRMI::MergeStats ms = index.merge_stats();
+    const double ns_per_tick = tsc_ns_per_tick();
+    for (int merging = 0; merging < 2; ++merging) {
+        std::vector<long long>& v = ticks[merging];
+        Stats st = compute_stats(v);
+        double max_ns = v.empty() ? 0.0
+                                  : *std::max_element(v.begin(), v.end()) * ns_per_tick;
+        const char* phase = merging ? "merging" : "idle";
+        cout << "DeltaRMI lookups while " << phase << ": " << v.size() << ", mean="
+             << st.mean_ns * ns_per_tick << " ns, p95=" << st.p95_ns * ns_per_tick
+             << " ns, p99=" << st.p99_ns * ns_per_tick << " ns, max=" << max_ns << " ns"
+             << endl;
+        csv << name << "," << leaves << "," << threshold << "," << write_fraction << ","
+            << ms.merges << "," << phase << "," << v.size() << ","
+            << st.mean_ns * ns_per_tick << "," << st.p95_ns * ns_per_tick << ","
+            << st.p99_ns * ns_per_tick << "," << max_ns << "\n";
+    }
+    cout << "DeltaRMI: " << ms.merges << " background merges, "
+         << ms.total_seconds * 1e3 << " ms total" << endl;
 }
 
 // ------------- Sanity checks -------------
 
-void sanity_check(const std::vector<std::uint64_t>& keys,
+// search_batch answers every query as search() does
+bool check_rmi_batch(const RMI& rmi, KeySpan queries, const std::string& what) {
+    std::vector<std::size_t> out(queries.size());
+    std::unique_ptr<bool[]> found(new bool[queries.size()]);
+    rmi.search_batch(queries, out, Span<bool>(found.get(), queries.size()));
+    for (std::size_t i = 0; i < queries.size(); ++i) {
+        std::size_t pos = 0;
+        bool hit = rmi.search(queries[i], pos);
+        if (found[i] != hit || (hit && out[i] != pos)) {
+            std::cerr << "[SANITY] " << what << ": search_batch differs from search for key "
+                      << queries[i] << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+void sanity_check(KeySpan keys,
                   BPTree& bpt,
                   RMI& rmi) {
     std::mt19937_64 rng(123);
@@ -129,7 +835,7 @@ void sanity_check(const std::vector<std::uint64_t>& keys,
 
         std::size_t pos_b = 0, pos_r = 0;
         bool ok_b = bpt.search(k, pos_b);
-        bool ok_r = rmi.search(keys, k, pos_r);
+        bool ok_r = rmi.search(k, pos_r);
 
         if (!ok_b || !ok_r || keys[pos_b] != k || keys[pos_r] != k) {
             std::cerr << "[SANITY] mismatch on existing key " << k
@@ -146,14 +852,160 @@ void sanity_check(const std::vector<std::uint64_t>& keys,
 
         std::size_t pos_b = 0, pos_r = 0;
         bool ok_b = bpt.search(k, pos_b);
-        bool ok_r = rmi.search(keys, k, pos_r);
+        bool ok_r = rmi.search(k, pos_r);
         (void)ok_b;
         (void)ok_r;
     }
 
+    // Batched lookups of keys and non-keys
+    std::vector<std::uint64_t> batch;
+    for (int i = 0; i < 1000; ++i) {
+        std::uint64_t k = keys[dist(rng)];
+        batch.push_back(i % 2 == 0 ? k : k + 1);
+    }
+    if (!check_rmi_batch(rmi, batch, "RMI")) return;
+
+    // Runs of duplicates: search() returns the first copy, so must the batch
+    std::vector<std::uint64_t> dups;
+    for (std::uint64_t k = 0; k < 5000; ++k) dups.insert(dups.end(), k % 9 + 1, k * 4);
+    RMI dup_rmi(64);
+    dup_rmi.train(KeySpan(dups));
+    batch.clear();
+    for (std::uint64_t k = 0; k < 5000; ++k) batch.push_back(k * 4 + (k % 5 == 0));
+    if (!check_rmi_batch(dup_rmi, batch, "RMI with duplicates")) return;
+
+    // A key array that is not the trained one must be rejected
+    bool rejected = false;
+    try {
+        rmi.attach(keys.subspan(0, keys.size() - 1));
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    if (!rejected) {
+        std::cerr << "[SANITY] RMI accepted a mismatched key array\n";
+        return;
+    }
+
+    // Order 2 would split internal nodes down to one child
+    rejected = false;
+    try {
+        BPTree tiny(2);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    if (!rejected) {
+        std::cerr << "[SANITY] BPTree accepted order 2\n";
+        return;
+    }
+
     std::cout << "[SANITY] basic checks passed.\n";
 }
 
+// The tree holds exactly expected (sorted): a leaf-chain scan sees those
+// keys in order, and search_batch agrees with search on each
+bool check_tree_contents(BPTree& tree, const std::vector<std::uint64_t>& expected,
+                         const std::string& what) {
+    std::size_t i = 0;
+    for (BPTree::Iterator it = tree.lower_bound(0); it.valid(); ++it, ++i) {
+        if (i >= expected.size() || it.key() != expected[i]) {
+            std::cerr << "[SANITY] " << what << ": scan differs at entry " << i << "\n";
+            return false;
+        }
+    }
+    if (i != expected.size()) {
+        std::cerr << "[SANITY] " << what << ": scan found " << i << " of "
+                  << expected.size() << " keys\n";
+        return false;
+    }
+    std::vector<std::size_t> out(expected.size());
+    std::unique_ptr<bool[]> found(new bool[expected.size()]);
+    tree.search_batch(expected, out, Span<bool>(found.get(), expected.size()));
+    for (std::size_t k = 0; k < expected.size(); ++k) {
+        std::size_t pos = 0;
+        if (!found[k] || !tree.search(expected[k], pos) || out[k] != pos) {
+            std::cerr << "[SANITY] " << what << ": key " << expected[k]
+                      << " missing or inconsistent in search_batch\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// B+Tree inserts and erases against the expected key set: up to max_keys
+// base keys are bulk-loaded, up to max_keys pending ones inserted and
+// erased again, then the base keys too, which go back in ascending order.
+// Small orders make nodes split, borrow, merge and collapse the root all
+// the time.
+void sanity_check_updates(const UpdateKeys& u, std::size_t order, std::size_t max_keys) {
+    std::string what = "BPTree(order " + std::to_string(order) + ") updates";
+    std::size_t stride = std::max<std::size_t>(1, (u.base.size() + max_keys - 1) / max_keys);
+    std::vector<std::uint64_t> base;
+    for (std::size_t i = 0; i < u.base.size(); i += stride) base.push_back(u.base[i]);
+    std::size_t num_pending = std::min(u.pending.size(), max_keys);
+
+    BPTree tree(order, 0.7);
+    tree.bulk_load(base);
+    for (std::size_t i = 0; i < num_pending; ++i) {
+        if (!tree.insert(u.pending[i], u.pending_pos[i])) {
+            std::cerr << "[SANITY] " << what << ": insert of new key " << u.pending[i]
+                      << " reported it present\n";
+            return;
+        }
+    }
+    for (std::size_t i = 0; i < num_pending; ++i) {
+        std::size_t pos = 0;
+        if (!tree.search(u.pending[i], pos) || pos != u.pending_pos[i]) {
+            std::cerr << "[SANITY] " << what << ": inserted key " << u.pending[i]
+                      << " not found with its value\n";
+            return;
+        }
+    }
+    std::vector<std::uint64_t> all = base;
+    all.insert(all.end(), u.pending.begin(), u.pending.begin() + num_pending);
+    std::sort(all.begin(), all.end());
+    if (!check_tree_contents(tree, all, what + " after inserts")) return;
+
+    for (std::size_t i = 0; i < num_pending; ++i) {
+        if (!tree.erase(u.pending[i])) {
+            std::cerr << "[SANITY] " << what << ": erase of " << u.pending[i] << " failed\n";
+            return;
+        }
+    }
+    for (std::size_t i = 0; i < num_pending; ++i) {
+        std::size_t pos = 0;
+        if (tree.search(u.pending[i], pos) || tree.erase(u.pending[i])) {
+            std::cerr << "[SANITY] " << what << ": erased key " << u.pending[i]
+                      << " still present\n";
+            return;
+        }
+    }
+    for (std::size_t i = 0; i < base.size(); ++i) {
+        std::size_t pos = 0;
+        if (!tree.search(base[i], pos) || pos != i) {
+            std::cerr << "[SANITY] " << what << ": base key " << base[i]
+                      << " lost by the erases\n";
+            return;
+        }
+    }
+    if (!check_tree_contents(tree, base, what + " after erases")) return;
+
+    // Emptying the tree collapses the root down to nothing
+    for (std::uint64_t k : base) tree.erase(k);
+    std::size_t pos = 0;
+    if (tree.lower_bound(0).valid() || !tree.insert(base[0], 7) ||
+        !tree.search(base[0], pos) || pos != 7) {
+        std::cerr << "[SANITY] " << what << ": emptied tree misbehaves\n";
+        return;
+    }
+
+    // Refill in ascending order, splitting the rightmost nodes every time
+    tree.erase(base[0]);
+    for (std::size_t i = 0; i < base.size(); ++i) tree.insert(base[i], i);
+    if (!check_tree_contents(tree, base, what + " after ascending inserts")) return;
+
+    std::cout << "[SANITY] " << what << " passed.\n";
+}
+
 // ------------- main -------------
 
 int main() {
@@ -163,7 +1015,81 @@ int main() {
         csv_lookup << "dataset,index,num_keys,num_leaves,metric,mean_ns,p95_ns,p99_ns\n";
 
         std::ofstream csv_build("results_build.csv");
-        csv_build << "dataset,index,num_keys,num_leaves,build_time_s,mem_bytes\n";
+        // mem_bytes: index-only; mem_with_data_bytes: index + key array it
+        // needs at query time; rss_delta_bytes: measured RSS growth over build
+        csv_build << "dataset,index,num_keys,num_leaves,build_time_s,"
+                  << "mem_bytes,mem_with_data_bytes,rss_delta_bytes\n";
+
+        std::ofstream csv_load("results_load.csv");
+        // RSS growth from loading the dataset, and the peak through the
+        // B+Tree build, both over the RSS just before loading; the peak is
+        // empty if the high-water mark cannot be reset
+        csv_load << "dataset,num_keys,key_bits,duplicates,mapped,load_time_s,"
+                 << "load_rss_delta_bytes,peak_rss_delta_bytes\n";
+
+        std::ofstream csv_tput("results_throughput.csv");
+        csv_tput << "dataset,index,num_keys,num_leaves,threads,mops\n";
+
+        std::ofstream csv_train("results_train_scaling.csv");
+        csv_train << "dataset,num_keys,num_leaves,threads,train_time_s,speedup,identical\n";
+
+        std::ofstream csv_range("results_range.csv");
+        csv_range << "dataset,index,num_keys,num_leaves,selectivity,num_ranges,"
+                  << "ns_per_range,mkeys_per_s\n";
+
+        // One row per Pareto-optimal tuner candidate; measured_ns is filled
+        // in for the candidate chosen under budget_bytes
+        std::ofstream csv_tuner("results_tuner.csv");
+        csv_tuner << "dataset,budget_bytes,root_model,leaf_model,num_leaves,mem_bytes,"
+                  << "log2_window,predicted_ns,chosen,measured_ns\n";
+
+        // 2-stage RMI against 3- and 4-stage ones with the same leaf budget
+        std::ofstream csv_stages("results_stages.csv");
+        csv_stages << "dataset,index,stages,num_keys,mem_bytes,train_time_s,"
+                   << "log2_window,mean_ns,p95_ns,p99_ns\n";
+
+        // Distribution of last-mile window sizes over the trained keys:
+        // keys whose window holds [window_min, window_max] positions
+        std::ofstream csv_windows("results_windows.csv");
+        csv_windows << "dataset,index,config,window_min,window_max,keys,fraction\n";
+
+        // Lookup time split into the model half (window prediction) and
+        // the last-mile search, per last-mile strategy
+        std::ofstream csv_last_mile("results_last_mile.csv");
+        csv_last_mile << "dataset,strategy,num_keys,num_leaves,model_ns,search_ns,"
+                      << "mean_ns,p95_ns,p99_ns\n";
+
+        std::ofstream csv_models("results_models.csv");
+        csv_models << "dataset,root_model,leaf_model,num_keys,num_leaves,train_time_s,"
+                   << "mem_bytes,mean_ns,p95_ns,p99_ns\n";
+
+        // Startup: rebuild from the dataset vs open a saved image
+        std::ofstream csv_startup("results_startup.csv");
+        csv_startup << "dataset,index,method,time_s,image_bytes,lookup_mean_ns\n";
+
+        // B+Tree inserts/erases: throughput and lookup latency per phase
+        std::ofstream csv_updates("results_updates.csv");
+        csv_updates << "dataset,fill_factor,phase,op,tree_keys,mops,lookup_mean_ns,"
+                    << "lookup_p99_ns,index_bytes\n";
+
+        // Read/write mixes: BPTree vs the updatable learned indexes
+        std::ofstream csv_mixes("results_mixes.csv");
+        csv_mixes << "dataset,index,mix,write_fraction,ops,mops,lookup_mean_ns,"
+                  << "lookup_p99_ns,index_bytes\n";
+
+        // Concurrent B+Tree: reader throughput with one writer active,
+        // optimistic lock coupling vs one global shared_mutex
+        std::ofstream csv_concurrent("results_concurrent.csv");
+        csv_concurrent << "dataset,scheme,readers,read_mops,write_mops\n";
+
+        // DeltaRMI: merge time vs delta size, and lookup latency with and
+        // without a background merge running
+        std::ofstream csv_delta_merge("results_delta_merge.csv");
+        csv_delta_merge << "dataset,num_leaves,main_keys,delta_keys,merge_time_s,"
+                        << "lookup_before_ns,lookup_after_ns\n";
+        std::ofstream csv_delta_latency("results_delta_latency.csv");
+        csv_delta_latency << "dataset,num_leaves,threshold,write_fraction,merges,phase,"
+                          << "lookups,mean_ns,p95_ns,p99_ns,max_ns\n";
         // =============================================
 
         std::string base = "data/"; // relative to project root
@@ -178,38 +1104,106 @@ int main() {
         // Change this to 1M / 5M / 10M as needed
         std::size_t max_keys    = 100'000'000;   // e.g., 1'000'000 or 5'000'000
         std::size_t num_queries = 100'000;
+        bool emit_clock_latency = true;           // also write legacy "lookup_clock" rows
+        std::vector<std::size_t> batch_sizes = {16, 64, 256};
+        // {keys per range, number of ranges}: about 1M keys scanned each
+        std::vector<std::pair<std::size_t, std::size_t>> range_workloads = {
+            {10, 100'000}, {1'000, 1'000}, {100'000, 10}};
+        bool compare_long_double = true;          // also run the long double linear RMI
+        bool sweep_models = true;                 // every root x leaf model combination
+        std::vector<LastMile> last_miles = {
+            LastMile::Binary, LastMile::Branchless, LastMile::Exponential,
+            LastMile::Interpolation, LastMile::Linear};
+        // Total model counts for the multi-stage comparison
+        std::vector<std::size_t> stage_model_counts = {1 << 10, 1 << 14, 1 << 18};
+        // Model memory budgets for the auto-tuner (empty = skip it)
+        std::vector<std::size_t> tuner_budgets = {64 << 10, 1 << 20, 16 << 20};
+        // B+Tree update workload: bulk-load fill factors, keys used, phases
+        std::vector<double> fill_factors = {1.0, 0.7};
+        std::size_t update_keys = 10'000'000;
+        std::size_t update_phases = 10;
+        // {name, share of inserts} for BPTree vs GappedRMI and DeltaRMI (empty = skip)
+        std::vector<std::pair<std::string, double>> update_mixes = {
+            {"read_heavy", 0.05}, {"balanced", 0.5}, {"write_heavy", 0.95}};
+        // Same, inserting new keys in order past either end of the base keys
+        std::vector<std::pair<std::string, double>> edge_mixes = {
+            {"append", 0.5}, {"prepend", 0.5}};
+        std::size_t mix_ops = 2'000'000;
+        bool concurrent_updates = true;           // readers + writer, OLC vs shared_mutex
+        std::size_t gapped_leaf_keys = 2048;      // bulk-loaded keys per GappedRMI leaf
+        // DeltaRMI: delta sizes to merge (empty = skip), background merge
+        // threshold and operations for the latency run
+        std::vector<std::size_t> delta_sizes = {1'000, 10'000, 100'000, 1'000'000};
+        std::size_t delta_threshold = 100'000;
+        double delta_write_fraction = 0.1;
+        std::size_t delta_ops = 4'000'000;
+        std::string image_dir = "images/";        // saved index images (empty = skip startup)
+        std::size_t tput_rounds = 10;             // passes over the queries per thread
+        std::vector<unsigned> tput_threads = thread_counts();
+
+        // mmap hints for the dataset files
+        DatasetOptions load_opts;
+        load_opts.populate   = true;
+        load_opts.huge_pages = false;
 
         using clock = std::chrono::high_resolution_clock;
 
+#if defined(__linux__)
+        if (!image_dir.empty()) ::mkdir(image_dir.c_str(), 0755);
+#endif
+
+        cout << "B+Tree node search kernel: " << count_le_isa() << endl;
+        cout << "Timestamp counter: " << 1.0 / tsc_ns_per_tick() << " ticks/ns" << endl;
+
         for (const auto& [name, path] : datasets) {
             cout << "\n==== Dataset: " << name << " ====" << endl;
-            auto keys = load_dataset(path, max_keys);
-            cout << "Loaded " << keys.size() << " keys from " << path << endl;
+            bool peak_reset = reset_peak_rss();
+            std::size_t rss_base = current_rss_bytes();
+            auto tl0 = clock::now();
+            Dataset data(path, max_keys, load_opts);
+            auto tl1 = clock::now();
+            std::size_t rss_loaded = current_rss_bytes();
+            std::chrono::duration<double> dt_l = tl1 - tl0;
+            KeySpan keys = data.keys();
+            cout << "Loaded " << keys.size() << " keys from " << path
+                 << (data.is_mapped() ? " (mmap)" : " (read)")
+                 << " in " << dt_l.count() << " s ("
+                 << data.key_bits() << "-bit, " << data.declared_count()
+                 << " declared, " << data.num_duplicates()
+                 << " duplicates)" << endl;
 
             // ---- Build B+Tree ----
             BPTree bpt(64);
+            std::size_t rss0 = current_rss_bytes();
             auto t0 = clock::now();
             bpt.bulk_load(keys);
             auto t1 = clock::now();
+            std::size_t rss1 = current_rss_bytes();
+            std::size_t rss_peak = peak_rss_bytes();
             std::chrono::duration<double> dt_b = t1 - t0;
             double build_time_b = dt_b.count();
-            std::size_t mem_b   = bpt.memory_usage_bytes();
+            MemoryUsage mem_b   = bpt.memory_usage();
+            long long rss_delta_b = static_cast<long long>(rss1) - static_cast<long long>(rss0);
 
             cout << "B+Tree build time: " << build_time_b
-                 << " s, approx mem " << mem_b / 1024.0 / 1024.0
-                 << " MB" << endl;
+                 << " s, mem " << mem_b.index_bytes / 1024.0 / 1024.0
+                 << " MB (RSS +" << rss_delta_b / 1024.0 / 1024.0
+                 << " MB)" << endl;
 
             // Write B+Tree build/mem stats (num_leaves left empty)
             csv_build << name << ",BPTree," << keys.size() << ","
                       << "" << ","
                       << build_time_b << ","
-                      << mem_b << "\n";
+                      << mem_b.index_bytes << ","
+                      << mem_b.total_bytes() << ","
+                      << rss_delta_b << "\n";
 
             // ---- Generate queries (shared across all indexes) ----
             auto queries = generate_queries(keys, num_queries);
 
             // ---- B+Tree lookup benchmark ----
-            auto stats_b = benchmark_bpt(keys, bpt, queries);
+            auto bpt_lookup = [&](std::uint64_t q, std::size_t& pos) { return bpt.search(q, pos); };
+            auto stats_b = benchmark_lookup(queries, bpt_lookup);
             cout << "B+Tree lookup: mean=" << stats_b.mean_ns
                  << " ns, p95=" << stats_b.p95_ns
                  << " ns, p99=" << stats_b.p99_ns << " ns" << endl;
@@ -220,6 +1214,53 @@ int main() {
                        << stats_b.p95_ns << ","
                        << stats_b.p99_ns << "\n";
 
+            if (emit_clock_latency) {
+                auto stats_bc = benchmark_clock(queries, bpt_lookup);
+                csv_lookup << name << ",BPTree," << keys.size() << ","
+                           << "" << ","
+                           << "lookup_clock," << stats_bc.mean_ns << ","
+                           << stats_bc.p95_ns << ","
+                           << stats_bc.p99_ns << "\n";
+            }
+
+            // ---- B+Tree batched lookups vs the single-key path above ----
+            for (std::size_t bs : batch_sizes) {
+                double ns = benchmark_batch(queries, bs,
+                    [&](KeySpan q, Span<std::size_t> out, Span<bool> found) {
+                        bpt.search_batch(q, out, found);
+                    });
+                cout << "B+Tree batch(" << bs << "): " << ns << " ns/key" << endl;
+                csv_lookup << name << ",BPTree," << keys.size() << ","
+                           << "" << ","
+                           << "batch_" << bs << "," << ns << ",,\n";
+            }
+
+            // ---- B+Tree range scans over the leaf chain ----
+            for (const auto& [sel, count] : range_workloads) {
+                auto ranges = generate_ranges(keys, sel, count);
+                std::size_t sum = 0;
+                auto rs = benchmark_range(ranges, [&](std::uint64_t lo, std::uint64_t hi) {
+                    return bpt.scan(lo, hi, [&](std::uint64_t, std::size_t pos) { sum += pos; });
+                });
+                do_not_optimize(sum);
+                cout << "B+Tree range(" << sel << "): " << rs.ns_per_range
+                     << " ns/range, " << rs.mkeys_per_s << " Mkeys/s" << endl;
+                csv_range << name << ",BPTree," << keys.size() << ","
+                          << "" << ","
+                          << sel << "," << count << ","
+                          << rs.ns_per_range << "," << rs.mkeys_per_s << "\n";
+            }
+
+            // ---- B+Tree throughput scaling ----
+            for (unsigned th : tput_threads) {
+                double mops = benchmark_throughput(th, queries, tput_rounds, bpt_lookup);
+                cout << "B+Tree throughput, " << th << " threads: "
+                     << mops << " Mops/s" << endl;
+                csv_tput << name << ",BPTree," << keys.size() << ","
+                         << "" << ","
+                         << th << "," << mops << "\n";
+            }
+
             // ---- RMI: sweep leaves on books/osm, use 64 elsewhere ----
             std::vector<int> leaf_configs;
             if (name == "books" || name == "osm") {
@@ -232,28 +1273,58 @@ int main() {
                 cout << "\n--- RMI with " << leaves << " leaves ---\n";
                 RMI rmi(leaves);
 
+                std::size_t rss2 = current_rss_bytes();
                 auto t2 = clock::now();
                 rmi.train(keys);
                 auto t3 = clock::now();
+                std::size_t rss3 = current_rss_bytes();
                 std::chrono::duration<double> dt_r = t3 - t2;
                 double train_time_r = dt_r.count();
-                std::size_t mem_r   = rmi.memory_usage_bytes();
+                MemoryUsage mem_r   = rmi.memory_usage();
+                long long rss_delta_r = static_cast<long long>(rss3) - static_cast<long long>(rss2);
 
                 cout << "RMI(" << leaves << ") train time: " << train_time_r
-                     << " s, approx mem " << mem_r / 1024.0
-                     << " KB" << endl;
+                     << " s, mem " << mem_r.index_bytes / 1024.0
+                     << " KB (+ " << mem_r.data_bytes / 1024.0 / 1024.0
+                     << " MB keys)" << endl;
 
                 // Write RMI build/mem stats
                 csv_build << name << ",RMI," << keys.size() << ","
                           << leaves << ","
                           << train_time_r << ","
-                          << mem_r << "\n";
+                          << mem_r.index_bytes << ","
+                          << mem_r.total_bytes() << ","
+                          << rss_delta_r << "\n";
+
+                // Parallel training: speed-up per thread count, checked
+                // against the serial models
+                for (unsigned th : tput_threads) {
+                    RMI rmi_par(leaves);
+                    auto tp0 = clock::now();
+                    rmi_par.train(keys, th);
+                    auto tp1 = clock::now();
+                    double t_par = std::chrono::duration<double>(tp1 - tp0).count();
+                    bool identical = rmi_par.same_models(rmi);
+                    cout << "RMI(" << leaves << ") train, " << th << " threads: "
+                         << t_par << " s (x" << train_time_r / t_par << ")"
+                         << (identical ? "" : " MODELS DIFFER") << endl;
+                    csv_train << name << "," << keys.size() << ","
+                              << leaves << "," << th << ","
+                              << t_par << "," << train_time_r / t_par << ","
+                              << (identical ? 1 : 0) << "\n";
+                }
 
                 // Sanity check
                 sanity_check(keys, bpt, rmi);
 
+                cout << "RMI(" << leaves << ") mean log2 window: "
+                     << rmi.mean_log2_window() << endl;
+                report_windows(name, "RMI", std::to_string(leaves),
+                               rmi.window_histogram(), keys.size(), csv_windows);
+
                 // RMI lookup benchmark
-                auto stats_r = benchmark_rmi(keys, rmi, queries);
+                auto rmi_lookup = [&](std::uint64_t q, std::size_t& pos) { return rmi.search(q, pos); };
+                auto stats_r = benchmark_lookup(queries, rmi_lookup);
 
                 cout << "RMI(" << leaves << ") lookup: mean=" << stats_r.mean_ns
                      << " ns, p95=" << stats_r.p95_ns
@@ -264,7 +1335,287 @@ int main() {
                            << "lookup," << stats_r.mean_ns << ","
                            << stats_r.p95_ns << ","
                            << stats_r.p99_ns << "\n";
+
+                if (emit_clock_latency) {
+                    auto stats_rc = benchmark_clock(queries, rmi_lookup);
+                    csv_lookup << name << ",RMI," << keys.size() << ","
+                               << leaves << ","
+                               << "lookup_clock," << stats_rc.mean_ns << ","
+                               << stats_rc.p95_ns << ","
+                               << stats_rc.p99_ns << "\n";
+                }
+
+                // RMI batched lookups
+                for (std::size_t bs : batch_sizes) {
+                    double ns = benchmark_batch(queries, bs,
+                        [&](KeySpan q, Span<std::size_t> out, Span<bool> found) {
+                            rmi.search_batch(q, out, found);
+                        });
+                    cout << "RMI(" << leaves << ") batch(" << bs << "): "
+                         << ns << " ns/key" << endl;
+                    csv_lookup << name << ",RMI," << keys.size() << ","
+                               << leaves << ","
+                               << "batch_" << bs << "," << ns << ",,\n";
+                }
+
+                // RMI range scans (same workloads as the tree)
+                for (const auto& [sel, count] : range_workloads) {
+                    auto ranges = generate_ranges(keys, sel, count);
+                    std::size_t sum = 0;
+                    auto rs = benchmark_range(ranges, [&](std::uint64_t lo, std::uint64_t hi) {
+                        return rmi.range(lo, hi, [&](std::uint64_t, std::size_t pos) { sum += pos; });
+                    });
+                    do_not_optimize(sum);
+                    cout << "RMI(" << leaves << ") range(" << sel << "): " << rs.ns_per_range
+                         << " ns/range, " << rs.mkeys_per_s << " Mkeys/s" << endl;
+                    csv_range << name << ",RMI," << keys.size() << ","
+                              << leaves << ","
+                              << sel << "," << count << ","
+                              << rs.ns_per_range << "," << rs.mkeys_per_s << "\n";
+                }
+
+                // RMI throughput scaling
+                for (unsigned th : tput_threads) {
+                    double mops = benchmark_throughput(th, queries, tput_rounds, rmi_lookup);
+                    cout << "RMI(" << leaves << ") throughput, " << th << " threads: "
+                         << mops << " Mops/s" << endl;
+                    csv_tput << name << ",RMI," << keys.size() << ","
+                             << leaves << ","
+                             << th << "," << mops << "\n";
+                }
+
+                // Same configuration with the original long double arithmetic
+                if (compare_long_double) {
+                    BasicRMI<LongDoubleLinearModel, LongDoubleLinearModel> rmi_ld(leaves);
+                    auto t4 = clock::now();
+                    rmi_ld.train(keys);
+                    auto t5 = clock::now();
+                    double train_time_ld = std::chrono::duration<double>(t5 - t4).count();
+                    auto stats_ld = benchmark_lookup(queries,
+                        [&](std::uint64_t q, std::size_t& pos) { return rmi_ld.search(q, pos); });
+
+                    cout << "RMI(" << leaves << ") long double: train " << train_time_ld
+                         << " s (x" << train_time_ld / train_time_r << "), lookup mean="
+                         << stats_ld.mean_ns << " ns (x"
+                         << stats_ld.mean_ns / stats_r.mean_ns << ")" << endl;
+
+                    MemoryUsage mem_ld = rmi_ld.memory_usage();
+                    csv_build << name << ",RMI-longdouble," << keys.size() << ","
+                              << leaves << ","
+                              << train_time_ld << ","
+                              << mem_ld.index_bytes << ","
+                              << mem_ld.total_bytes() << ","
+                              << "" << "\n";
+                    csv_lookup << name << ",RMI-longdouble," << keys.size() << ","
+                               << leaves << ","
+                               << "lookup," << stats_ld.mean_ns << ","
+                               << stats_ld.p95_ns << ","
+                               << stats_ld.p99_ns << "\n";
+                }
+            }
+
+            // ---- RMI last-mile strategies: model time vs search time ----
+            {
+                std::size_t leaves = leaf_configs.back();
+                cout << "\n--- RMI last mile, " << leaves << " leaves ---\n";
+                for (LastMile lm : last_miles) {
+                    RMI rmi(leaves, lm);
+                    rmi.train(keys);
+                    auto stats_m = benchmark_lookup(queries, [&](std::uint64_t q, std::size_t& pos) {
+                        std::size_t lo = 0, end = 0;
+                        rmi.window(q, lo, end);
+                        pos = lo;
+                        return lo < end;
+                    });
+                    auto stats_t = benchmark_lookup(queries, [&](std::uint64_t q, std::size_t& pos) {
+                        return rmi.search(q, pos);
+                    });
+                    double search_ns = std::max(0.0, stats_t.mean_ns - stats_m.mean_ns);
+                    cout << "RMI(" << leaves << ") " << last_mile_name(lm)
+                         << ": model " << stats_m.mean_ns << " ns + search "
+                         << search_ns << " ns = " << stats_t.mean_ns
+                         << " ns, p99=" << stats_t.p99_ns << " ns" << endl;
+                    csv_last_mile << name << "," << last_mile_name(lm) << ","
+                                  << keys.size() << "," << leaves << ","
+                                  << stats_m.mean_ns << "," << search_ns << ","
+                                  << stats_t.mean_ns << "," << stats_t.p95_ns << ","
+                                  << stats_t.p99_ns << "\n";
+                }
+            }
+
+            // ---- Multi-stage RMI vs 2-stage at equal memory: the deeper
+            // indexes spend part of the same model count on inner stages,
+            // and inner models are smaller than leaves ----
+            for (std::size_t total : stage_model_counts) {
+                if (total > keys.size() / 4) continue;
+                unsigned lg = 0;
+                while ((std::size_t(1) << (lg + 1)) <= total) ++lg;
+                cout << "\n--- RMI stages, " << total << " models ---\n";
+
+                RMI rmi2(total);
+                benchmark_staged(name, "RMI", "1x" + std::to_string(total),
+                                 rmi2, keys, queries, csv_stages, csv_windows);
+
+                std::size_t f = std::size_t(1) << (lg / 2);
+                StagedRMI<LinearModel, LinearModel> rmi3({1, f, total - f});
+                benchmark_staged(name, "StagedRMI", rmi3.stages_name(),
+                                 rmi3, keys, queries, csv_stages, csv_windows);
+
+                std::size_t f1 = std::size_t(1) << (lg / 3);
+                std::size_t f2 = std::size_t(1) << (2 * lg / 3);
+                StagedRMI<LinearModel, LinearModel> rmi4({1, f1, f2, total - f1 - f2});
+                benchmark_staged(name, "StagedRMI", rmi4.stages_name(),
+                                 rmi4, keys, queries, csv_stages, csv_windows);
+            }
+
+            // ---- RMI auto-tuner: pick a configuration per memory budget
+            // from a sample, then measure it on the full key set ----
+            if (!tuner_budgets.empty()) {
+                auto tt0 = clock::now();
+                std::vector<RMICandidate> candidates = tune_rmi(keys);
+                auto tt1 = clock::now();
+                cout << "\n--- RMI auto-tuner: " << candidates.size() << " candidates in "
+                     << std::chrono::duration<double>(tt1 - tt0).count() << " s ---\n";
+                for (std::size_t budget : tuner_budgets) {
+                    const RMICandidate& pick = pick_rmi(candidates, budget);
+                    double measured = 0.0;
+                    visit_rmi_type(pick, [&](auto* tag) {
+                        using Index = std::remove_pointer_t<decltype(tag)>;
+                        Index rmi(pick.num_leaves);
+                        rmi.train(keys);
+                        measured = benchmark_lookup(queries,
+                            [&](std::uint64_t q, std::size_t& pos) {
+                                return rmi.search(q, pos);
+                            }).mean_ns;
+                    });
+                    cout << "Budget " << budget / 1024.0 << " KB: "
+                         << pick.root_model << "-" << pick.leaf_model
+                         << " x " << pick.num_leaves << " leaves, "
+                         << pick.model_bytes / 1024.0 << " KB, predicted "
+                         << pick.predicted_ns << " ns, measured " << measured
+                         << " ns" << endl;
+                    for (const RMICandidate& c : candidates) {
+                        if (!c.pareto) continue;
+                        bool chosen = &c == &pick;
+                        csv_tuner << name << "," << budget << ","
+                                  << c.root_model << "," << c.leaf_model << ","
+                                  << c.num_leaves << "," << c.model_bytes << ","
+                                  << c.log2_window << "," << c.predicted_ns << ","
+                                  << (chosen ? 1 : 0) << ",";
+                        if (chosen) csv_tuner << measured;
+                        csv_tuner << "\n";
+                    }
+                }
+            }
+
+            // ---- RMI model types: every root x leaf combination at the
+            // largest leaf count of this dataset ----
+            if (sweep_models) {
+                std::size_t leaves = leaf_configs.back();
+                cout << "\n--- RMI model sweep, " << leaves << " leaves ---\n";
+                for_each_rmi_type([&](auto* tag) {
+                    using Index = std::remove_pointer_t<decltype(tag)>;
+                    benchmark_models<Index>(name, keys, queries, leaves, csv_models);
+                });
+            }
+
+            // ---- Updates: B+Tree aging, and read/write mixes ----
+            UpdateKeys update_set = split_update_keys(keys, update_keys);
+            if (!update_set.base.empty()) {
+                sanity_check_updates(update_set, 64, 1'000'000);
+                sanity_check_updates(update_set, 4, 100'000);
+                sanity_check_updates(update_set, 3, 100'000);
+            }
+            if (!fill_factors.empty()) {
+                cout << "\n--- B+Tree updates ---\n";
+                for (double fill : fill_factors) {
+                    benchmark_updates(name, update_set, fill, update_phases,
+                                      num_queries, csv_updates);
+                }
+            }
+            if (!update_mixes.empty() || !edge_mixes.empty()) {
+                cout << "\n--- Read/write mixes ---\n";
+                std::size_t gapped_leaves =
+                    std::max<std::size_t>(1, update_set.base.size() / gapped_leaf_keys);
+                auto run_mix = [&](const UpdateKeys& u, const std::string& mix,
+                                   double write_fraction) {
+                    BPTree tree(64, fill_factors.empty() ? 1.0 : fill_factors.back());
+                    benchmark_mix(name, "BPTree", tree, u, mix, write_fraction,
+                                  mix_ops, num_queries, csv_mixes);
+                    GappedRMI gapped(gapped_leaves);
+                    benchmark_mix(name, "GappedRMI", gapped, u, mix, write_fraction,
+                                  mix_ops, num_queries, csv_mixes);
+                    DeltaRMI delta(leaf_configs.back());
+                    delta.start_background_merge(delta_threshold);
+                    benchmark_mix(name, "DeltaRMI", delta, u, mix, write_fraction,
+                                  mix_ops, num_queries, csv_mixes);
+                };
+                for (const auto& [mix, write_fraction] : update_mixes) {
+                    run_mix(update_set, mix, write_fraction);
+                }
+                for (const auto& [mix, write_fraction] : edge_mixes) {
+                    UpdateKeys edge_set = edge_update_keys(update_set, mix == "append");
+                    if (!edge_set.pending.empty()) run_mix(edge_set, mix, write_fraction);
+                }
+            }
+            if (concurrent_updates) {
+                cout << "\n--- Concurrent B+Tree: readers with a writer ---\n";
+                double fill = fill_factors.empty() ? 1.0 : fill_factors.back();
+                auto update_queries = generate_queries(update_set.base, num_queries);
+                for (unsigned th : tput_threads) {
+                    benchmark_concurrent<false>(name, update_set, fill, th, update_queries,
+                                                tput_rounds, csv_concurrent);
+                    benchmark_concurrent<true>(name, update_set, fill, th, update_queries,
+                                               tput_rounds, csv_concurrent);
+                }
+            }
+            if (!delta_sizes.empty()) {
+                std::size_t leaves = leaf_configs.back();
+                cout << "\n--- Delta-buffered RMI ---\n";
+                for (std::size_t d : delta_sizes) {
+                    benchmark_delta_merge(name, update_set, leaves, d, num_queries,
+                                          csv_delta_merge);
+                }
+                benchmark_delta_latency(name, update_set, leaves, delta_threshold,
+                                        delta_write_fraction, delta_ops, csv_delta_latency);
+            }
+
+            // ---- Startup: rebuild vs open a saved image ----
+            if (!image_dir.empty()) {
+                std::size_t leaves = leaf_configs.back();
+                cout << "\n--- Startup ---\n";
+                benchmark_startup(name, "BPTree", path, max_keys, load_opts, bpt,
+                                  image_dir + name + ".bpt", queries,
+                                  [] { return BPTree(64); },
+                                  [](BPTree& t, KeySpan k) { t.bulk_load(k); }, csv_startup);
+                RMI rmi(leaves);
+                rmi.train(keys);
+                benchmark_startup(name, "RMI", path, max_keys, load_opts, rmi,
+                                  image_dir + name + ".rmi", queries,
+                                  [leaves] { return RMI(leaves); },
+                                  [](RMI& r, KeySpan k) { r.train(k); }, csv_startup);
+            }
+
+            // Measured around this dataset's load and B+Tree build only,
+            // the cross-check for "no key copies": about the key bytes
+            long long load_rss = static_cast<long long>(rss_loaded) -
+                                 static_cast<long long>(rss_base);
+            long long peak_rss = static_cast<long long>(rss_peak) -
+                                 static_cast<long long>(rss_base);
+            cout << "\nLoad time " << dt_l.count() << " s, RSS +"
+                 << load_rss / 1024.0 / 1024.0 << " MB after loading";
+            if (peak_reset) {
+                cout << ", peak +" << peak_rss / 1024.0 / 1024.0 << " MB through the build";
             }
+            cout << endl;
+            csv_load << name << "," << keys.size() << ","
+                     << data.key_bits() << ","
+                     << data.num_duplicates() << ","
+                     << (data.is_mapped() ? 1 : 0) << ","
+                     << dt_l.count() << ","
+                     << load_rss << ",";
+            if (peak_reset) csv_load << peak_rss;
+            csv_load << "\n";
         }
     } catch (const std::exception& e) {
         cerr << "Error: " << e.what() << endl;
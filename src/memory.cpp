@@ -0,0 +1,63 @@
+#include "memory.h"
+
+#include <fstream>
+#include <limits>
+#include <string>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#if defined(__unix__)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+std::size_t heap_block_bytes(const void* p, std::size_t requested) {
+    if (!p) return 0;
+#if defined(__GLIBC__)
+    (void)requested;
+    return malloc_usable_size(const_cast<void*>(p)) + sizeof(std::size_t);
+#else
+    return requested;
+#endif
+}
+
+std::size_t current_rss_bytes() {
+#if defined(__unix__)
+    std::ifstream in("/proc/self/statm");
+    std::size_t total_pages = 0, resident_pages = 0;
+    if (!(in >> total_pages >> resident_pages)) return 0;
+    return resident_pages * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#else
+    return 0;
+#endif
+}
+
+std::size_t peak_rss_bytes() {
+#if defined(__linux__)
+    // VmHWM, unlike ru_maxrss, follows reset_peak_rss()
+    std::ifstream in("/proc/self/status");
+    std::string field;
+    std::size_t kb = 0;
+    while (in >> field) {
+        if (field == "VmHWM:" && in >> kb) return kb * 1024;
+        in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+#endif
+#if defined(__unix__)
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+    return static_cast<std::size_t>(ru.ru_maxrss) * 1024;  // KB on Linux
+#else
+    return 0;
+#endif
+}
+
+bool reset_peak_rss() {
+#if defined(__linux__)
+    std::ofstream out("/proc/self/clear_refs");
+    return static_cast<bool>(out << "5" << std::flush);
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Byte accounting for an index, split into what the index owns and the
+// data it has to keep around to answer queries.
+struct MemoryUsage {
+    std::size_t index_bytes = 0;  // owned structures incl. allocator overhead
+    std::size_t data_bytes  = 0;  // key array read at query time, not owned
+    std::size_t total_bytes() const { return index_bytes + data_bytes; }
+};
+
+// Bytes the heap actually holds for a block of `requested` bytes at p:
+// usable size plus chunk header on glibc, `requested` elsewhere.
+std::size_t heap_block_bytes(const void* p, std::size_t requested);
+
+template <typename T>
+std::size_t vector_heap_bytes(const std::vector<T>& v) {
+    if (v.capacity() == 0) return 0;
+    return heap_block_bytes(v.data(), v.capacity() * sizeof(T));
+}
+
+// Resident set size of this process, 0 if it cannot be read
+std::size_t current_rss_bytes();
+
+// High-water mark of the resident set size, 0 if it cannot be read
+std::size_t peak_rss_bytes();
+
+// Restart the high-water mark from the current RSS (Linux: VmHWM via
+// /proc/self/clear_refs); false if that is not supported
+bool reset_peak_rss();
@@ -0,0 +1,287 @@
+#include "models.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Sums are accumulated per fixed-size block and the block results are
+// added in block order, whatever the thread count. That makes the
+// floating-point result, and so the trained model, independent of how
+// many threads did the work.
+constexpr std::size_t kSumBlock = std::size_t(1) << 16;
+
+template <typename Partial, typename BlockFn>
+Partial reduce_blocks(std::size_t n, unsigned threads, BlockFn block_fn) {
+    std::size_t num_blocks = (n + kSumBlock - 1) / kSumBlock;
+    Partial total{};
+    if (threads <= 1 || num_blocks <= 1) {
+        for (std::size_t blk = 0; blk < num_blocks; ++blk) {
+            total += block_fn(blk * kSumBlock, std::min(n, (blk + 1) * kSumBlock));
+        }
+        return total;
+    }
+    std::vector<Partial> parts(num_blocks);
+    parallel_for(num_blocks, threads, [&](std::size_t blk) {
+        parts[blk] = block_fn(blk * kSumBlock, std::min(n, (blk + 1) * kSumBlock));
+    });
+    for (const Partial& part : parts) total += part;
+    return total;
+}
+
+struct RawSums {
+    long double x = 0.0L, y = 0.0L, x2 = 0.0L, xy = 0.0L;
+    RawSums& operator+=(const RawSums& o) {
+        x += o.x; y += o.y; x2 += o.x2; xy += o.xy;
+        return *this;
+    }
+};
+
+struct Sum {
+    double v = 0.0;
+    Sum& operator+=(const Sum& o) { v += o.v; return *this; }
+};
+
+struct CentredSums {
+    double xx = 0.0, xy = 0.0;
+    CentredSums& operator+=(const CentredSums& o) {
+        xx += o.xx; xy += o.xy;
+        return *this;
+    }
+};
+
+// Power sums for the cubic normal equations: s[k] = sum t^k (k <= 6),
+// ty[k] = sum t^k * i (k <= 3)
+struct PowerSums {
+    double s[7] = {};
+    double ty[4] = {};
+    PowerSums& operator+=(const PowerSums& o) {
+        for (int k = 0; k < 7; ++k) s[k] += o.s[k];
+        for (int k = 0; k < 4; ++k) ty[k] += o.ty[k];
+        return *this;
+    }
+};
+
+// Least squares y = a * f(x) + b with y = y0 + i, in two passes over f
+template <typename F>
+void fit_centred(std::size_t n, std::size_t y0, unsigned threads, F f,
+                 double& a, double& b) {
+    if (n == 0) {
+        a = 0.0;
+        b = 0.0;
+        return;
+    }
+    // y is y0, y0+1, ...: its mean and centred values need no pass
+    Sum sum = reduce_blocks<Sum>(n, threads, [&](std::size_t lo, std::size_t hi) {
+        Sum part;
+        for (std::size_t i = lo; i < hi; ++i) part.v += f(i);
+        return part;
+    });
+    double mean_x = sum.v / static_cast<double>(n);
+    double mean_i = static_cast<double>(n - 1) / 2.0;
+    CentredSums c = reduce_blocks<CentredSums>(n, threads, [&](std::size_t lo, std::size_t hi) {
+        CentredSums part;
+        for (std::size_t i = lo; i < hi; ++i) {
+            double dx = f(i) - mean_x;
+            double dy = static_cast<double>(i) - mean_i;
+            part.xx += dx * dx;
+            part.xy += dx * dy;
+        }
+        return part;
+    });
+    if (c.xx <= 0.0) {
+        a = 0.0;
+        b = static_cast<double>(y0) + mean_i;
+    } else {
+        // Sorted keys give a non-negative slope; guard against rounding
+        // so that predictions stay monotone
+        a = std::max(0.0, c.xy / c.xx);
+        b = static_cast<double>(y0) + mean_i - a * mean_x;
+    }
+}
+
+// Solve the 4x4 system m * c = r by Gaussian elimination with partial
+// pivoting; false if it is (numerically) singular
+bool solve4(double m[4][4], double r[4], double c[4]) {
+    for (int col = 0; col < 4; ++col) {
+        int piv = col;
+        for (int row = col + 1; row < 4; ++row) {
+            if (std::fabs(m[row][col]) > std::fabs(m[piv][col])) piv = row;
+        }
+        if (std::fabs(m[piv][col]) < 1e-12) return false;
+        if (piv != col) {
+            for (int k = 0; k < 4; ++k) std::swap(m[piv][k], m[col][k]);
+            std::swap(r[piv], r[col]);
+        }
+        for (int row = col + 1; row < 4; ++row) {
+            double f = m[row][col] / m[col][col];
+            for (int k = col; k < 4; ++k) m[row][k] -= f * m[col][k];
+            r[row] -= f * r[col];
+        }
+    }
+    for (int row = 3; row >= 0; --row) {
+        double v = r[row];
+        for (int k = row + 1; k < 4; ++k) v -= m[row][k] * c[k];
+        c[row] = v / m[row][row];
+    }
+    return true;
+}
+
+// c1 + 2 c2 t + 3 c3 t^2 >= 0 on [0, 1]
+bool cubic_monotone(double c1, double c2, double c3) {
+    auto deriv = [&](double t) { return c1 + 2.0 * c2 * t + 3.0 * c3 * t * t; };
+    const double tol = -1e-9 * (std::fabs(c1) + std::fabs(c2) + std::fabs(c3));
+    if (deriv(0.0) < tol || deriv(1.0) < tol) return false;
+    if (c3 != 0.0) {
+        double t = -c2 / (3.0 * c3);
+        if (t > 0.0 && t < 1.0 && deriv(t) < tol) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+void LinearModel::fit(KeySpan x, std::size_t y0, std::uint64_t base,
+                      unsigned threads) {
+    fit_centred(x.size(), y0, threads,
+                [&](std::size_t i) { return static_cast<double>(x[i] - base); },
+                a, b);
+}
+
+void LongDoubleLinearModel::fit(KeySpan x, std::size_t y0, std::uint64_t base,
+                                unsigned threads) {
+    std::size_t n = x.size();
+    if (n == 0) {
+        a = 0.0;
+        b = 0.0;
+        return;
+    }
+    RawSums sums = reduce_blocks<RawSums>(n, threads, [&](std::size_t lo, std::size_t hi) {
+        RawSums part;
+        for (std::size_t i = lo; i < hi; ++i) {
+            long double xi = static_cast<long double>(x[i] - base);
+            long double yi = static_cast<long double>(y0 + i);
+            part.x += xi;
+            part.y += yi;
+            part.x2 += xi * xi;
+            part.xy += xi * yi;
+        }
+        return part;
+    });
+    long double n_ld = static_cast<long double>(n);
+    long double denom = n_ld * sums.x2 - sums.x * sums.x;
+    if (std::fabs(static_cast<double>(denom)) < 1e-12) {
+        a = 0.0;
+        b = static_cast<double>(sums.y / n_ld);
+    } else {
+        long double num = n_ld * sums.xy - sums.x * sums.y;
+        long double a_ld = num / denom;
+        long double b_ld = (sums.y - a_ld * sums.x) / n_ld;
+        // Guard against rounding so that predictions stay monotone
+        if (a_ld < 0) {
+            a_ld = 0;
+            b_ld = sums.y / n_ld;
+        }
+        a = static_cast<double>(a_ld);
+        b = static_cast<double>(b_ld);
+    }
+}
+
+void CubicModel::fit(KeySpan x, std::size_t y0, std::uint64_t base,
+                     unsigned threads) {
+    std::size_t n = x.size();
+    c0 = c1 = c2 = c3 = 0.0;
+    if (n == 0) {
+        x_min = x_max = 0;
+        inv_range = 0.0;
+        return;
+    }
+    x_min = x[0] - base;
+    x_max = x[n - 1] - base;
+    double mean_i = static_cast<double>(n - 1) / 2.0;
+    if (x_max == x_min) {
+        inv_range = 0.0;
+        c0 = static_cast<double>(y0) + mean_i;
+        return;
+    }
+    inv_range = 1.0 / static_cast<double>(x_max - x_min);
+
+    PowerSums ps = reduce_blocks<PowerSums>(n, threads, [&](std::size_t lo, std::size_t hi) {
+        PowerSums part;
+        for (std::size_t i = lo; i < hi; ++i) {
+            double t = static_cast<double>(x[i] - base - x_min) * inv_range;
+            double y = static_cast<double>(i);
+            double tk = 1.0;
+            for (int k = 0; k < 7; ++k) {
+                part.s[k] += tk;
+                if (k < 4) part.ty[k] += tk * y;
+                tk *= t;
+            }
+        }
+        return part;
+    });
+
+    double m[4][4], r[4], c[4];
+    for (int row = 0; row < 4; ++row) {
+        for (int col = 0; col < 4; ++col) m[row][col] = ps.s[row + col];
+        r[row] = ps.ty[row];
+    }
+    if (n >= 4 && solve4(m, r, c) && cubic_monotone(c[1], c[2], c[3])) {
+        c0 = c[0]; c1 = c[1]; c2 = c[2]; c3 = c[3];
+    } else {
+        // Straight line in t from the same sums
+        double det = ps.s[0] * ps.s[2] - ps.s[1] * ps.s[1];
+        if (det > 0.0) {
+            c1 = std::max(0.0, (ps.s[0] * ps.ty[1] - ps.s[1] * ps.ty[0]) / det);
+            c0 = (ps.ty[0] - c1 * ps.s[1]) / ps.s[0];
+        } else {
+            c0 = mean_i;
+        }
+    }
+    c0 += static_cast<double>(y0);
+}
+
+void LogLinearModel::fit(KeySpan x, std::size_t y0, std::uint64_t base,
+                         unsigned threads) {
+    fit_centred(x.size(), y0, threads,
+                [&](std::size_t i) { return std::log2(static_cast<double>(x[i] - base) + 1.0); },
+                a, b);
+}
+
+double LogLinearModel::predict(std::uint64_t x) const {
+    return a * std::log2(static_cast<double>(x) + 1.0) + b;
+}
+
+template <unsigned Bits>
+void RadixModel<Bits>::fit(KeySpan x, std::size_t y0, std::uint64_t base,
+                           unsigned threads) {
+    (void)threads;  // a single sequential pass
+    std::size_t n = x.size();
+    table.clear();
+    if (n == 0) {
+        x_min = x_max = 0;
+        shift = 0;
+        inv_bucket = 0.0;
+        return;
+    }
+    x_min = x[0] - base;
+    x_max = x[n - 1] - base;
+    std::uint64_t range = x_max - x_min;
+    unsigned width = 0;
+    while (width < 64 && (range >> width) != 0) ++width;
+    shift = width > Bits ? width - Bits : 0;
+    inv_bucket = 1.0 / static_cast<double>(std::uint64_t(1) << shift);
+
+    // table[p] = first position whose prefix is >= p
+    std::size_t buckets = static_cast<std::size_t>(range >> shift) + 1;
+    table.assign(buckets + 1, static_cast<double>(y0 + n));
+    std::size_t next = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        std::size_t p = static_cast<std::size_t>((x[i] - base - x_min) >> shift);
+        while (next <= p) table[next++] = static_cast<double>(y0 + i);
+    }
+}
+
+template struct RadixModel<16>;
+template struct RadixModel<6>;
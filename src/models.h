@@ -0,0 +1,129 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "memory.h"
+#include "span.h"
+
+// Model types for RMI stages. Every model maps a key, already shifted
+// down by the RMI's smallest key, to an estimated position, and provides
+//
+//   static const char* name();
+//   void fit(KeySpan x, std::size_t y0, std::uint64_t base, unsigned threads);
+//       least-squares style fit of sorted keys x[i] (minus base) to y0 + i;
+//       sums are reduced in a fixed block order so the result does not
+//       depend on threads
+//   double predict(std::uint64_t x) const;   // x = key - base
+//   void scale(double s);                    // multiply all predictions by s
+//   std::size_t heap_bytes() const;
+//   bool operator==(const Model&) const;
+//
+// Predictions must be monotone non-decreasing in x: the RMI relies on it
+// to route each leaf a contiguous run of keys.
+
+// y = a * x + b in double, fitted by two-pass centred least squares
+struct LinearModel {
+    double a = 0.0;
+    double b = 0.0;
+
+    static const char* name() { return "linear"; }
+    void fit(KeySpan x, std::size_t y0, std::uint64_t base, unsigned threads);
+    double predict(std::uint64_t x) const {
+        return a * static_cast<double>(x) + b;
+    }
+    void scale(double s) { a *= s; b *= s; }
+    std::size_t heap_bytes() const { return 0; }
+    bool operator==(const LinearModel& o) const { return a == o.a && b == o.b; }
+};
+
+// The original formulation: one-pass raw sums and predictions in x87
+// long double. Kept as the baseline for the double-precision path.
+struct LongDoubleLinearModel {
+    double a = 0.0;
+    double b = 0.0;
+
+    static const char* name() { return "linear-ld"; }
+    void fit(KeySpan x, std::size_t y0, std::uint64_t base, unsigned threads);
+    double predict(std::uint64_t x) const {
+        return static_cast<double>(static_cast<long double>(a) * static_cast<long double>(x) +
+                                   static_cast<long double>(b));
+    }
+    void scale(double s) { a *= s; b *= s; }
+    std::size_t heap_bytes() const { return 0; }
+    bool operator==(const LongDoubleLinearModel& o) const { return a == o.a && b == o.b; }
+};
+
+// One cubic segment over the model's key range: keys are normalised to
+// t in [0, 1] and y = c0 + c1 t + c2 t^2 + c3 t^3 is fitted by least
+// squares. Falls back to a straight line in t when the cubic is not
+// monotone on [0, 1]; keys outside the range clamp to its ends.
+struct CubicModel {
+    double c0 = 0.0, c1 = 0.0, c2 = 0.0, c3 = 0.0;
+    std::uint64_t x_min = 0;
+    std::uint64_t x_max = 0;
+    double inv_range = 0.0;
+
+    static const char* name() { return "cubic"; }
+    void fit(KeySpan x, std::size_t y0, std::uint64_t base, unsigned threads);
+    double predict(std::uint64_t x) const {
+        double t = x <= x_min ? 0.0
+                 : x >= x_max ? 1.0
+                 : static_cast<double>(x - x_min) * inv_range;
+        return ((c3 * t + c2) * t + c1) * t + c0;
+    }
+    void scale(double s) { c0 *= s; c1 *= s; c2 *= s; c3 *= s; }
+    std::size_t heap_bytes() const { return 0; }
+    bool operator==(const CubicModel& o) const {
+        return c0 == o.c0 && c1 == o.c1 && c2 == o.c2 && c3 == o.c3 &&
+               x_min == o.x_min && x_max == o.x_max && inv_range == o.inv_range;
+    }
+};
+
+// y = a * log2(x + 1) + b: for keys whose density falls off with magnitude
+struct LogLinearModel {
+    double a = 0.0;
+    double b = 0.0;
+
+    static const char* name() { return "loglinear"; }
+    void fit(KeySpan x, std::size_t y0, std::uint64_t base, unsigned threads);
+    double predict(std::uint64_t x) const;
+    void scale(double s) { a *= s; b *= s; }
+    std::size_t heap_bytes() const { return 0; }
+    bool operator==(const LogLinearModel& o) const { return a == o.a && b == o.b; }
+};
+
+// Radix table on the top Bits bits of (x - x_min): table[p] is the first
+// position whose prefix is >= p, and predictions interpolate linearly
+// inside a prefix bucket. Table size is at most 2^Bits + 2 entries.
+template <unsigned Bits>
+struct RadixModel {
+    std::uint64_t x_min = 0;
+    std::uint64_t x_max = 0;
+    unsigned shift = 0;
+    double inv_bucket = 0.0;      // 1 / 2^shift
+    std::vector<double> table;
+
+    static const char* name() { return "radix"; }
+    void fit(KeySpan x, std::size_t y0, std::uint64_t base, unsigned threads);
+    double predict(std::uint64_t x) const {
+        if (table.empty()) return 0.0;
+        if (x <= x_min) return table.front();
+        if (x > x_max) return table.back();
+        std::uint64_t d = x - x_min;
+        std::size_t p = static_cast<std::size_t>(d >> shift);
+        double frac = static_cast<double>(d & ((std::uint64_t(1) << shift) - 1)) * inv_bucket;
+        return table[p] + (table[p + 1] - table[p]) * frac;
+    }
+    void scale(double s) {
+        for (double& v : table) v *= s;
+    }
+    std::size_t heap_bytes() const { return vector_heap_bytes(table); }
+    bool operator==(const RadixModel& o) const {
+        return x_min == o.x_min && x_max == o.x_max && shift == o.shift &&
+               inv_bucket == o.inv_bucket && table == o.table;
+    }
+};
+
+using RadixRootModel = RadixModel<16>;
+using RadixLeafModel = RadixModel<6>;
@@ -0,0 +1,36 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Number of threads to use for a request of `threads` (0 = all hardware threads)
+inline unsigned resolve_threads(unsigned threads) {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    return std::max(1u, threads);
+}
+
+// Run fn(i) for every i in [0, n) on up to `threads` threads, the caller
+// included. Tasks are handed out one at a time from a shared counter, so
+// uneven task sizes balance themselves.
+template <typename Fn>
+void parallel_for(std::size_t n, unsigned threads, Fn fn) {
+    threads = resolve_threads(threads);
+    if (threads == 1 || n <= 1) {
+        for (std::size_t i = 0; i < n; ++i) fn(i);
+        return;
+    }
+    std::atomic<std::size_t> next{0};
+    auto worker = [&] {
+        for (std::size_t i = next.fetch_add(1); i < n; i = next.fetch_add(1)) {
+            fn(i);
+        }
+    };
+    std::size_t extra = std::min<std::size_t>(threads, n) - 1;
+    std::vector<std::thread> pool;
+    pool.reserve(extra);
+    for (std::size_t t = 0; t < extra; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto& th : pool) th.join();
+}
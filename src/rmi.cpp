@@ -1,178 +1,391 @@
 #include "rmi.h"
+#include "parallel.h"
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <stdexcept>
+#include <type_traits>
 
-RMI::RMI(std::size_t num_leaves)
-    : num_leaves_(num_leaves), root_{0.0, 0.0, 0, 0, 0} {}
+template <typename RootModel, typename LeafModel>
+BasicRMI<RootModel, LeafModel>::BasicRMI(std::size_t num_leaves, LastMile last_mile)
+    : num_leaves_(num_leaves), last_mile_(last_mile), num_keys_(0), key_base_(0),
+      leaf_table_(nullptr), leaf_limit_(static_cast<double>(num_leaves)), pos_limit_(0.0) {}
 
-void RMI::fit_linear(const std::vector<std::uint64_t>& x,
-                     const std::vector<std::size_t>& y,
-                     double& a, double& b) {
-    std::size_t n = x.size();
-    if (n == 0) {
-        a = 0.0;
-        b = 0.0;
-        return;
+template <typename RootModel, typename LeafModel>
+void BasicRMI<RootModel, LeafModel>::train(KeySpan keys, unsigned threads) {
+    if (keys.empty()) {
+        throw std::runtime_error("RMI::train: empty keys");
     }
-    long double sum_x = 0.0L, sum_y = 0.0L;
-    long double sum_x2 = 0.0L, sum_xy = 0.0L;
-    for (std::size_t i = 0; i < n; ++i) {
-        long double xi = static_cast<long double>(x[i]);
-        long double yi = static_cast<long double>(y[i]);
-        sum_x += xi;
-        sum_y += yi;
-        sum_x2 += xi * xi;
-        sum_xy += xi * yi;
+    keys_.reference(keys);
+    train_models(threads);
+}
+
+template <typename RootModel, typename LeafModel>
+void BasicRMI<RootModel, LeafModel>::train(std::vector<std::uint64_t>&& keys,
+                                           unsigned threads) {
+    if (keys.empty()) {
+        throw std::runtime_error("RMI::train: empty keys");
     }
-    long double n_ld = static_cast<long double>(n);
-    long double denom = n_ld * sum_x2 - sum_x * sum_x;
-    if (std::fabs(static_cast<double>(denom)) < 1e-12) {
-        a = 0.0;
-        b = static_cast<double>(sum_y / n_ld);
+    keys_.own(std::move(keys));
+    train_models(threads);
+}
+
+template <typename RootModel, typename LeafModel>
+void BasicRMI<RootModel, LeafModel>::attach(KeySpan keys) {
+    if (keys.size() != num_keys_ || (num_keys_ > 0 && keys[0] != key_base_)) {
+        throw std::invalid_argument("RMI::attach: keys differ from the trained keys");
+    }
+    keys_.reference(keys);
+}
+
+namespace {
+
+// RMI image: metadata after the header, then the root model, the leaf
+// table and the keys, each aligned for in-place use
+struct RMIImageMeta {
+    char root_model[16];
+    char leaf_model[16];
+    std::uint64_t num_leaves;
+    std::uint64_t num_keys;
+    std::uint64_t key_base;
+    std::uint64_t root_bytes;    // sizeof(RootModel), layout check
+    std::uint64_t leaf_bytes;    // sizeof(Leaf), layout check
+    std::uint64_t root_offset;
+    std::uint64_t leaves_offset;
+    std::uint64_t keys_offset;
+};
+
+constexpr std::size_t kImageAlign = 64;
+constexpr std::size_t kImagePageBytes = 4096;
+
+std::size_t align_up(std::size_t x, std::size_t a) {
+    return (x + a - 1) / a * a;
+}
+
+} // namespace
+
+template <typename RootModel, typename LeafModel>
+void BasicRMI<RootModel, LeafModel>::save(const std::string& path) const {
+    if constexpr (!std::is_trivially_copyable<RootModel>::value ||
+                  !std::is_trivially_copyable<LeafModel>::value) {
+        (void)path;
+        throw std::logic_error("RMI::save: " + model_name() + " models have no flat image");
     } else {
-        long double num = n_ld * sum_xy - sum_x * sum_y;
-        long double a_ld = num / denom;
-        long double b_ld = (sum_y - a_ld * sum_x) / n_ld;
-        a = static_cast<double>(a_ld);
-        b = static_cast<double>(b_ld);
+        RMIImageMeta meta{};
+        std::strncpy(meta.root_model, RootModel::name(), sizeof(meta.root_model) - 1);
+        std::strncpy(meta.leaf_model, LeafModel::name(), sizeof(meta.leaf_model) - 1);
+        meta.num_leaves = leaves().size();
+        meta.num_keys = num_keys_;
+        meta.key_base = key_base_;
+        meta.root_bytes = sizeof(RootModel);
+        meta.leaf_bytes = sizeof(Leaf);
+        meta.root_offset = align_up(sizeof(ImageHeader) + sizeof(meta), kImageAlign);
+        meta.leaves_offset = align_up(meta.root_offset + sizeof(RootModel), kImageAlign);
+        meta.keys_offset = align_up(meta.leaves_offset + meta.num_leaves * sizeof(Leaf),
+                                    kImagePageBytes);
+
+        ImageWriter out(path, ImageKind::RMI);
+        out.write(&meta, sizeof(meta));
+        out.align(kImageAlign);
+        out.write(&root_, sizeof(RootModel));
+        out.align(kImageAlign);
+        out.write(leaf_table_, meta.num_leaves * sizeof(Leaf));
+        out.align(kImagePageBytes);
+        out.write(keys_.data(), num_keys_ * sizeof(std::uint64_t));
+        out.finish();
     }
 }
 
-void RMI::train(const std::vector<std::uint64_t>& keys) {
-    std::size_t n = keys.size();
-    if (n == 0) {
-        throw std::runtime_error("RMI::train: empty keys");
+template <typename RootModel, typename LeafModel>
+void BasicRMI<RootModel, LeafModel>::open(const std::string& path, bool verify) {
+    if constexpr (!std::is_trivially_copyable<RootModel>::value ||
+                  !std::is_trivially_copyable<LeafModel>::value) {
+        (void)path;
+        (void)verify;
+        throw std::logic_error("RMI::open: " + model_name() + " models have no flat image");
+    } else {
+        auto image = std::make_unique<MappedImage>(path, ImageKind::RMI, verify);
+        const RMIImageMeta& meta = *image->at<RMIImageMeta>(sizeof(ImageHeader), 1);
+        if (std::strncmp(meta.root_model, RootModel::name(), sizeof(meta.root_model)) != 0 ||
+            std::strncmp(meta.leaf_model, LeafModel::name(), sizeof(meta.leaf_model)) != 0 ||
+            meta.root_bytes != sizeof(RootModel) || meta.leaf_bytes != sizeof(Leaf)) {
+            throw std::runtime_error("RMI::open: " + path + " holds other model types than " +
+                                     model_name());
+        }
+        if (meta.num_leaves == 0 || meta.num_keys == 0) {
+            throw std::runtime_error("RMI::open: empty index in " + path);
+        }
+        const RootModel* root = image->at<RootModel>(meta.root_offset, 1);
+        const Leaf* leaves = image->at<Leaf>(meta.leaves_offset, meta.num_leaves);
+        const std::uint64_t* keys = image->at<std::uint64_t>(meta.keys_offset, meta.num_keys);
+
+        std::memcpy(static_cast<void*>(&root_), root, sizeof(RootModel));
+        std::vector<Leaf>().swap(leaves_);
+        leaf_table_ = leaves;
+        num_leaves_ = meta.num_leaves;
+        num_keys_ = meta.num_keys;
+        key_base_ = meta.key_base;
+        leaf_limit_ = static_cast<double>(num_leaves_);
+        pos_limit_ = static_cast<double>(num_keys_);
+        keys_.reference(KeySpan(keys, num_keys_));
+        image_ = std::move(image);
     }
+}
 
-    // Root model: full key -> index mapping
-    std::vector<std::uint64_t> x_root(keys);
-    std::vector<std::size_t> y_root(n);
-    for (std::size_t i = 0; i < n; ++i) y_root[i] = i;
+// Streaming trainer. Keys are sorted and the root model is monotone, so
+// every leaf's keys form one contiguous run: leaf boundaries are found by
+// binary search and each leaf is fitted in place over its run, with the
+// position implied by the index. Extra memory is O(num_leaves).
+//
+// With threads > 1 the root sums are sharded by key range and the leaves
+// (boundary search, fit, error pass) are spread over the threads. Every
+// sum is reduced in a fixed block order, so the models are bit-identical
+// to a single-threaded train.
+template <typename RootModel, typename LeafModel>
+void BasicRMI<RootModel, LeafModel>::train_models(unsigned threads) {
+    KeySpan keys = keys_.span();
+    std::size_t n = keys.size();
+    threads = resolve_threads(threads);
+    num_keys_ = n;
+    key_base_ = keys[0];
+    pos_limit_ = static_cast<double>(n);
 
-    double a_root = 0.0, b_root = 0.0;
-    fit_linear(x_root, y_root, a_root, b_root);
-    root_.a = a_root;
-    root_.b = b_root;
-    root_.start_idx = 0;
-    root_.end_idx = n;
-    root_.max_error = 0;
+    // Root model: full key -> index mapping, then scaled so that it
+    // predicts leaf ids directly
+    root_ = RootModel();
+    root_.fit(keys, 0, key_base_, threads);
+    root_.scale(static_cast<double>(num_leaves_) / static_cast<double>(n));
 
-    // Use root prediction to assign keys to leaf buckets
     leaves_.clear();
-    leaves_.resize(num_leaves_, {0.0, 0.0, 0, 0, 0});
-    std::vector<std::vector<std::size_t>> buckets(num_leaves_);
-
-    auto clamp_pos = [n](long double p) -> std::size_t {
-        if (p < 0) return 0;
-        if (p >= static_cast<long double>(n)) return n - 1;
-        return static_cast<std::size_t>(p);
-    };
-
-    for (std::size_t i = 0; i < n; ++i) {
-        long double pred = static_cast<long double>(a_root) *
-                           static_cast<long double>(keys[i]) +
-                           static_cast<long double>(b_root);
-        std::size_t pos = clamp_pos(pred);
-        std::size_t leaf_id = (pos * num_leaves_) / n;
-        if (leaf_id >= num_leaves_) leaf_id = num_leaves_ - 1;
-        buckets[leaf_id].push_back(i);
-    }
+    leaves_.resize(num_leaves_, Leaf{LeafModel(), 0, 0, 0, 0});
+    leaf_table_ = leaves_.data();
 
-    // For each leaf: fit local model and compute max_error / start / end
-    for (std::size_t leaf_id = 0; leaf_id < num_leaves_; ++leaf_id) {
-        auto& idxs = buckets[leaf_id];
-        if (idxs.empty()) {
-            leaves_[leaf_id] = {0.0, 0.0, 0, 0, 0};
-            continue;
+    // Run ends: ends[l] = first index routed past leaf l
+    std::vector<std::size_t> ends(num_leaves_);
+    parallel_for(num_leaves_, threads, [&](std::size_t leaf_id) {
+        std::size_t lo = 0, hi = n;
+        while (lo < hi) {
+            std::size_t mid = (lo + hi) / 2;
+            if (leaf_for(keys[mid]) <= leaf_id) lo = mid + 1;
+            else hi = mid;
         }
-        std::vector<std::uint64_t> x;
-        std::vector<std::size_t> y;
-        x.reserve(idxs.size());
-        y.reserve(idxs.size());
-        for (std::size_t idx : idxs) {
-            x.push_back(keys[idx]);
-            y.push_back(idx);
+        ends[leaf_id] = lo;
+    });
+
+    // For each leaf: local model and signed error range over its run
+    // [start, end)
+    parallel_for(num_leaves_, threads, [&](std::size_t leaf_id) {
+        std::size_t start = leaf_id == 0 ? 0 : ends[leaf_id - 1];
+        std::size_t end = ends[leaf_id];
+        Leaf& leaf = leaves_[leaf_id];
+        leaf.start_idx = start;
+        leaf.end_idx = end;
+        if (end == start) return;  // empty leaf keeps a zero model
+
+        leaf.model.fit(keys.subspan(start, end - start), start, key_base_, 1);
+
+        // Errors of the exact prediction search() will make
+        std::int64_t min_err = 0, max_err = 0;
+        for (std::size_t i = start; i < end; ++i) {
+            std::int64_t err = static_cast<std::int64_t>(i) -
+                               static_cast<std::int64_t>(predict(leaf, keys[i]));
+            if (i == start || err < min_err) min_err = err;
+            if (i == start || err > max_err) max_err = err;
         }
-        double a = 0.0, b = 0.0;
-        fit_linear(x, y, a, b);
-
-        std::size_t max_err = 0;
-        std::size_t start_idx = y[0];
-        std::size_t end_idx = y[0];
-        for (std::size_t i = 0; i < x.size(); ++i) {
-            long double pred = static_cast<long double>(a) *
-                               static_cast<long double>(x[i]) +
-                               static_cast<long double>(b);
-            std::size_t pos = clamp_pos(pred);
-            std::size_t true_pos = y[i];
-            std::size_t err = (pos > true_pos) ? (pos - true_pos) : (true_pos - pos);
-            if (err > max_err) max_err = err;
-            if (true_pos < start_idx) start_idx = true_pos;
-            if (true_pos > end_idx) end_idx = true_pos;
+        leaf.min_error = min_err;
+        leaf.max_error = max_err;
+    });
+
+    // Drop an opened image unless the keys trained on live in it
+    if (image_ && !image_->contains(keys_.data())) image_.reset();
+}
+
+template <typename RootModel, typename LeafModel>
+bool BasicRMI<RootModel, LeafModel>::same_models(const BasicRMI& other) const {
+    if (num_leaves_ != other.num_leaves_ || num_keys_ != other.num_keys_ ||
+        key_base_ != other.key_base_ || !(root_ == other.root_) ||
+        leaves().size() != other.leaves().size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < leaves().size(); ++i) {
+        const Leaf& l = leaf_table_[i];
+        const Leaf& r = other.leaf_table_[i];
+        if (!(l.model == r.model) || l.start_idx != r.start_idx ||
+            l.end_idx != r.end_idx || l.min_error != r.min_error ||
+            l.max_error != r.max_error) {
+            return false;
         }
-        leaves_[leaf_id].a = a;
-        leaves_[leaf_id].b = b;
-        leaves_[leaf_id].start_idx = start_idx;
-        leaves_[leaf_id].end_idx = end_idx + 1; // end is exclusive
-        leaves_[leaf_id].max_error = max_err;
     }
+    return true;
 }
 
-bool RMI::search(const std::vector<std::uint64_t>& keys,
-                 std::uint64_t key,
-                 std::size_t& pos) const {
-    std::size_t n = keys.size();
-    if (n == 0) return false;
-
-    auto clamp_pos = [n](long double p) -> std::size_t {
-        if (p < 0) return 0;
-        if (p >= static_cast<long double>(n)) return n - 1;
-        return static_cast<std::size_t>(p);
-    };
-
-    // Root prediction -> leaf id
-    long double pred_root = static_cast<long double>(root_.a) *
-                            static_cast<long double>(key) +
-                            static_cast<long double>(root_.b);
-    std::size_t pos_root = clamp_pos(pred_root);
-    std::size_t leaf_id = (pos_root * num_leaves_) / n;
-    if (leaf_id >= num_leaves_) leaf_id = num_leaves_ - 1;
-
-    const auto& leaf = leaves_[leaf_id];
-
-    long double pred_leaf = static_cast<long double>(leaf.a) *
-                            static_cast<long double>(key) +
-                            static_cast<long double>(leaf.b);
-    std::size_t p = clamp_pos(pred_leaf);
-
-    std::size_t lo = leaf.start_idx;
-    std::size_t hi = (leaf.end_idx == 0) ? 0 : leaf.end_idx - 1;
-    if (leaf.max_error > 0) {
-        std::size_t left = (p > leaf.max_error) ? (p - leaf.max_error) : 0;
-        std::size_t right = std::min(p + leaf.max_error, n - 1);
-        if (left > lo) lo = left;
-        if (right < hi) hi = right;
+template <typename RootModel, typename LeafModel>
+std::size_t BasicRMI<RootModel, LeafModel>::leaf_for(std::uint64_t key) const {
+    double p = root_.predict(shifted(key));
+    if (!(p > 0.0)) return 0;
+    if (p >= leaf_limit_) return num_leaves_ - 1;
+    return static_cast<std::size_t>(p);
+}
+
+template <typename RootModel, typename LeafModel>
+std::size_t BasicRMI<RootModel, LeafModel>::predict(const Leaf& leaf,
+                                                    std::uint64_t key) const {
+    double p = leaf.model.predict(shifted(key));
+    if (!(p > 0.0)) return 0;
+    if (p >= pos_limit_) return num_keys_ - 1;
+    return static_cast<std::size_t>(p);
+}
+
+template <typename RootModel, typename LeafModel>
+std::size_t BasicRMI<RootModel, LeafModel>::search_window(const Leaf& leaf, std::uint64_t key,
+                                                          std::size_t& lo,
+                                                          std::size_t& end) const {
+    std::size_t p = predict(leaf, key);
+    error_window(p, leaf.min_error, leaf.max_error, leaf.start_idx, leaf.end_idx, lo, end);
+    return p;
+}
+
+template <typename RootModel, typename LeafModel>
+void BasicRMI<RootModel, LeafModel>::window(std::uint64_t key, std::size_t& lo,
+                                            std::size_t& end) const {
+    lo = end = 0;
+    if (num_keys_ == 0) return;
+    search_window(leaf_table_[leaf_for(key)], key, lo, end);
+}
+
+template <typename RootModel, typename LeafModel>
+bool BasicRMI<RootModel, LeafModel>::search(std::uint64_t key, std::size_t& pos) const {
+    if (num_keys_ == 0) return false;
+
+    // Root prediction -> leaf id -> leaf prediction window -> last mile
+    std::size_t lo = 0, end = 0;
+    std::size_t p = search_window(leaf_table_[leaf_for(key)], key, lo, end);
+    std::size_t i = last_mile_search(last_mile_, keys_.data(), key, p, lo, end);
+    if (i == end || keys_[i] != key) return false;
+    pos = i;
+    return true;
+}
+
+template <typename RootModel, typename LeafModel>
+std::size_t BasicRMI<RootModel, LeafModel>::lower_bound(std::uint64_t key) const {
+    if (num_keys_ == 0) return 0;
+
+    std::size_t lo = 0, end = 0;
+    std::size_t p = search_window(leaf_table_[leaf_for(key)], key, lo, end);
+    return window_lower_bound(keys_.span(), key, lo, end, last_mile_, p);
+}
+
+template <typename RootModel, typename LeafModel>
+void BasicRMI<RootModel, LeafModel>::search_batch(KeySpan queries,
+                                                  Span<std::size_t> out,
+                                                  Span<bool> found) const {
+    constexpr std::size_t kGroup = 16;
+    KeySpan keys = keys_.span();
+    std::size_t m = queries.size();
+    if (num_keys_ == 0) {
+        for (std::size_t i = 0; i < m; ++i) found[i] = false;
+        return;
     }
 
-    // Local binary search around predicted position
-    while (lo <= hi) {
-        std::size_t mid = (lo + hi) / 2;
-        std::uint64_t mid_key = keys[mid];
-        if (key < mid_key) {
-            if (mid == 0) break;
-            hi = mid - 1;
-        } else if (key > mid_key) {
-            lo = mid + 1;
-        } else {
-            pos = mid;
-            return true;
+    const Leaf* leaf[kGroup];
+    std::size_t base[kGroup], len[kGroup], window_end[kGroup];
+    for (std::size_t g0 = 0; g0 < m; g0 += kGroup) {
+        std::size_t g = std::min(kGroup, m - g0);
+        const std::uint64_t* q = queries.data() + g0;
+
+        // Stage 1: root predictions, prefetch each leaf model
+        for (std::size_t i = 0; i < g; ++i) {
+            leaf[i] = &leaf_table_[leaf_for(q[i])];
+            __builtin_prefetch(leaf[i]);
         }
+
+        // Stage 2: leaf predictions, prefetch the middle of each window
+        std::size_t active = 0;
+        for (std::size_t i = 0; i < g; ++i) {
+            std::size_t lo = 0, end = 0;
+            search_window(*leaf[i], q[i], lo, end);
+            base[i] = lo;
+            len[i] = end - lo;
+            window_end[i] = end;
+            if (len[i] > 1) ++active;
+            __builtin_prefetch(keys.data() + lo + len[i] / 2);
+        }
+
+        // Stage 3: binary searches in lockstep, one probe per query per
+        // round, prefetching the next probe so the misses overlap. Keys
+        // before base are < key; the first key >= key, which search()
+        // returns among duplicates, is base or the one after it.
+        while (active > 0) {
+            active = 0;
+            for (std::size_t i = 0; i < g; ++i) {
+                if (len[i] <= 1) continue;
+                std::size_t half = len[i] / 2;
+                base[i] = (keys[base[i] + half] < q[i]) ? base[i] + half : base[i];
+                len[i] -= half;
+                if (len[i] > 1) {
+                    ++active;
+                    __builtin_prefetch(keys.data() + base[i] + len[i] / 2);
+                }
+            }
+        }
+
+        for (std::size_t i = 0; i < g; ++i) {
+            std::size_t pos = base[i] + (len[i] > 0 && keys[base[i]] < q[i]);
+            bool hit = pos < window_end[i] && keys[pos] == q[i];
+            found[g0 + i] = hit;
+            if (hit) out[g0 + i] = pos;
+        }
+    }
+}
+
+template <typename RootModel, typename LeafModel>
+MemoryUsage BasicRMI<RootModel, LeafModel>::memory_usage() const {
+    MemoryUsage m;
+    m.index_bytes = sizeof(*this) + root_.heap_bytes() + vector_heap_bytes(leaves_);
+    for (const Leaf& leaf : leaves()) m.index_bytes += leaf.model.heap_bytes();
+    // A mapped image holds the leaves and the keys
+    if (image_) m.index_bytes += image_->size() - num_keys_ * sizeof(std::uint64_t);
+    m.data_bytes  = keys_.owned() ? keys_.heap_bytes() : num_keys_ * sizeof(std::uint64_t);
+    return m;
+}
+
+template <typename RootModel, typename LeafModel>
+double BasicRMI<RootModel, LeafModel>::mean_log2_window() const {
+    if (num_keys_ == 0) return 0.0;
+    double sum = 0.0;
+    for (const Leaf& leaf : leaves()) {
+        std::size_t len = leaf.end_idx - leaf.start_idx;
+        if (len == 0) continue;
+        std::size_t w = window_size(leaf.min_error, leaf.max_error, len);
+        sum += static_cast<double>(len) * std::log2(static_cast<double>(w));
+    }
+    return sum / static_cast<double>(num_keys_);
+}
+
+template <typename RootModel, typename LeafModel>
+std::vector<std::size_t> BasicRMI<RootModel, LeafModel>::window_histogram() const {
+    std::vector<std::size_t> hist;
+    for (const Leaf& leaf : leaves()) {
+        std::size_t len = leaf.end_idx - leaf.start_idx;
+        if (len == 0) continue;
+        add_window(hist, window_size(leaf.min_error, leaf.max_error, len), len);
     }
-    return false;
+    return hist;
 }
 
-std::size_t RMI::memory_usage_bytes() const {
-    return sizeof(LinearModel) * (1 + leaves_.size());
-}
\ No newline at end of file
+// Shipped model combinations: every root model with every leaf model,
+// plus the long double baseline
+#define RMI_INSTANTIATE_LEAVES(Root)                         \
+    template class BasicRMI<Root, LinearModel>;              \
+    template class BasicRMI<Root, CubicModel>;               \
+    template class BasicRMI<Root, LogLinearModel>;           \
+    template class BasicRMI<Root, RadixLeafModel>;
+
+RMI_INSTANTIATE_LEAVES(LinearModel)
+RMI_INSTANTIATE_LEAVES(CubicModel)
+RMI_INSTANTIATE_LEAVES(LogLinearModel)
+RMI_INSTANTIATE_LEAVES(RadixRootModel)
+template class BasicRMI<LongDoubleLinearModel, LongDoubleLinearModel>;
+
+#undef RMI_INSTANTIATE_LEAVES
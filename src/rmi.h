@@ -2,37 +2,183 @@
 #include <vector>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <string>
 
-struct LinearModel {
-    double a;
-    double b;
-    std::size_t start_idx;
-    std::size_t end_idx;   // exclusive
-    std::size_t max_error;
-};
+#include "image.h"
+#include "key_array.h"
+#include "last_mile.h"
+#include "memory.h"
+#include "models.h"
+#include "span.h"
 
-class RMI {
+// Two-stage recursive model index: a root model routes each key to one of
+// num_leaves leaf models, whose prediction plus a per-leaf error bound gives
+// the window for the last-mile search. RootModel and LeafModel are any of
+// the model types in models.h. Member functions are defined in rmi.cpp and
+// explicitly instantiated there for the shipped model combinations.
+//
+// Models see keys shifted down by the smallest key; predictions are in
+// double, and error bounds are computed with the same predict() that
+// search() uses, so they hold for the arithmetic actually run.
+template <typename RootModel, typename LeafModel>
+class BasicRMI {
 public:
-    explicit RMI(std::size_t num_leaves = 64);
+    // last_mile picks how search() and lower_bound() look inside the
+    // predicted window; search_batch() always uses its lockstep search
+    explicit BasicRMI(std::size_t num_leaves = 64, LastMile last_mile = LastMile::Binary);
+
+    LastMile last_mile() const { return last_mile_; }
+
+    // "root-leaf" model names, e.g. "linear-linear"
+    static std::string model_name() {
+        return root_model_name() + "-" + leaf_model_name();
+    }
+    static std::string root_model_name() { return RootModel::name(); }
+    static std::string leaf_model_name() { return LeafModel::name(); }
+
+    // keys must be sorted (SOSD data is already sorted). The span overload
+    // keeps a view of keys, which must outlive the index and stay
+    // unchanged; the vector overload takes ownership. threads > 1 trains
+    // in parallel (0 = all hardware threads) and yields exactly the same
+    // models as threads = 1.
+    void train(KeySpan keys, unsigned threads = 1);
+    void train(std::vector<std::uint64_t>&& keys, unsigned threads = 1);
+
+    // Point a trained index at another copy of its training keys, e.g.
+    // after reloading them. Throws std::invalid_argument if keys does not
+    // have the trained size and first key.
+    void attach(KeySpan keys);
+
+    KeySpan keys() const { return keys_.span(); }
+
+    // Write the models and keys to a versioned, checksummed image at path.
+    // Throws std::logic_error for model types that keep heap storage
+    // (radix tables), which have no flat layout, and std::runtime_error on
+    // I/O failure.
+    void save(const std::string& path) const;
+
+    // Replace the index with the image at path. Leaf models and keys are
+    // used in place from a read-only mapping; only the root model is
+    // copied. verify checks the payload checksum, reading the whole file.
+    // Throws std::runtime_error if the image is missing, corrupt or holds
+    // other model types.
+    void open(const std::string& path, bool verify = true);
+    bool is_mapped() const { return image_ != nullptr; }
+
+    // True if other holds bit-identical models (same configuration and data)
+    bool same_models(const BasicRMI& other) const;
+
+    // Lookup key; on success return true and write its position to pos
+    bool search(std::uint64_t key, std::size_t& pos) const;
+
+    // Look up queries[i] for every i, writing out[i]/found[i] as search()
+    // would. Queries are processed in groups whose model lookups and
+    // last-mile binary searches run in lockstep with prefetching, so the
+    // cache misses of different queries overlap. out and found must be at
+    // least queries.size().
+    void search_batch(KeySpan queries, Span<std::size_t> out, Span<bool> found) const;
+
+    // The model half of a lookup: the window [lo, end) of key positions
+    // that search() will look in for key
+    void window(std::uint64_t key, std::size_t& lo, std::size_t& end) const;
 
-    // keys must be sorted (SOSD data is already sorted)
-    void train(const std::vector<std::uint64_t>& keys);
+    // Position of the first key >= key (number of keys if none).
+    // Searches the leaf's error window first; since the error bounds only
+    // cover keys seen in training, an answer on the window edge is checked
+    // and the search gallops outward when the window missed it.
+    std::size_t lower_bound(std::uint64_t key) const;
 
-    // Lookup key in keys; on success return true and write position to pos
-    bool search(const std::vector<std::uint64_t>& keys,
-                std::uint64_t key,
-                std::size_t& pos) const;
+    // Call cb(key, position) for every key in [lo, hi), scanning the keys
+    // sequentially from lower_bound(lo); returns the number visited
+    template <typename Callback>
+    std::size_t range(std::uint64_t lo, std::uint64_t hi, Callback cb) const {
+        std::size_t i = lower_bound(lo);
+        std::size_t start = i;
+        for (; i < keys_.size() && keys_[i] < hi; ++i) {
+            cb(keys_[i], i);
+        }
+        return i - start;
+    }
 
-    // Rough memory usage estimate
-    std::size_t memory_usage_bytes() const;
+    // Exact bytes held by the models; data_bytes is the sorted key array
+    // that search() needs alongside them, whether owned or not.
+    MemoryUsage memory_usage() const;
+
+    // Mean over the trained keys of log2 of their leaf's last-mile window
+    // size: about the number of binary search probes per lookup
+    double mean_log2_window() const;
+
+    // hist[b] = number of trained keys whose leaf window holds between 2^b
+    // and 2^(b+1) - 1 positions
+    std::vector<std::size_t> window_histogram() const;
 
 private:
+    // Signed errors (true - predicted position) over the leaf's keys: the
+    // key is in [p + min_error, p + max_error] for prediction p. Linear
+    // leaves usually err one way, so this is narrower than p +- max |error|.
+    struct Leaf {
+        LeafModel model;
+        std::size_t start_idx;
+        std::size_t end_idx;   // exclusive
+        std::int64_t min_error;
+        std::int64_t max_error;
+    };
+
     std::size_t num_leaves_;
-    LinearModel root_;
-    std::vector<LinearModel> leaves_;
+    LastMile last_mile_;
+    KeyArray keys_;
+    std::size_t num_keys_;
+    std::uint64_t key_base_;   // smallest key; models see key - key_base_
+    RootModel root_;           // predicts leaf ids (scaled by num_leaves / n)
+    std::vector<Leaf> leaves_; // trained leaves; empty after open()
+    const Leaf* leaf_table_;   // leaves_ or the mapped image
+    std::unique_ptr<MappedImage> image_;
+
+    // Clamp limits as doubles, so predictions need no conversions
+    double leaf_limit_;        // num_leaves_
+    double pos_limit_;         // num_keys_
+
+    Span<const Leaf> leaves() const {
+        return Span<const Leaf>(leaf_table_, leaf_table_ ? num_leaves_ : 0);
+    }
+
+    std::uint64_t shifted(std::uint64_t key) const {
+        return key > key_base_ ? key - key_base_ : 0;
+    }
 
-    // Ordinary least squares fit: y ≈ a * x + b
-    static void fit_linear(const std::vector<std::uint64_t>& x,
-                           const std::vector<std::size_t>& y,
-                           double& a, double& b);
+    // Root prediction -> leaf id
+    std::size_t leaf_for(std::uint64_t key) const;
+
+    // Leaf prediction clamped to [0, num_keys_)
+    std::size_t predict(const Leaf& leaf, std::uint64_t key) const;
+
+    // Half-open window [lo, end) of positions that can hold key according
+    // to leaf, within the leaf's run; lo <= end. Returns the prediction.
+    std::size_t search_window(const Leaf& leaf, std::uint64_t key,
+                              std::size_t& lo, std::size_t& end) const;
+
+    void train_models(unsigned threads);
 };
+
+// The default configuration: linear root, linear leaves
+using RMI = BasicRMI<LinearModel, LinearModel>;
+
+// Call fn(static_cast<BasicRMI<Root, Leaf>*>(nullptr)) for every root x
+// leaf combination instantiated in rmi.cpp, e.g. to sweep or to map model
+// names chosen at run time onto a type
+template <typename Root, typename Fn>
+void for_each_rmi_leaf_type(Fn& fn) {
+    fn(static_cast<BasicRMI<Root, LinearModel>*>(nullptr));
+    fn(static_cast<BasicRMI<Root, CubicModel>*>(nullptr));
+    fn(static_cast<BasicRMI<Root, LogLinearModel>*>(nullptr));
+    fn(static_cast<BasicRMI<Root, RadixLeafModel>*>(nullptr));
+}
+
+template <typename Fn>
+void for_each_rmi_type(Fn fn) {
+    for_each_rmi_leaf_type<LinearModel>(fn);
+    for_each_rmi_leaf_type<CubicModel>(fn);
+    for_each_rmi_leaf_type<LogLinearModel>(fn);
+    for_each_rmi_leaf_type<RadixRootModel>(fn);
+}
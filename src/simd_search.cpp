@@ -0,0 +1,96 @@
+#include "simd_search.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_SEARCH_X86 1
+#endif
+
+namespace {
+
+// Branch-free upper_bound
+std::size_t count_le_scalar(const std::uint64_t* keys, std::size_t n,
+                            std::uint64_t key) {
+    const std::uint64_t* base = keys;
+    std::size_t len = n;
+    while (len > 1) {
+        std::size_t half = len / 2;
+        base = (base[half - 1] <= key) ? base + half : base;
+        len -= half;
+    }
+    return static_cast<std::size_t>(base - keys) + (len == 1 && base[0] <= key);
+}
+
+#ifdef SIMD_SEARCH_X86
+__attribute__((target("avx2")))
+std::size_t count_le_avx2(const std::uint64_t* keys, std::size_t n,
+                          std::uint64_t key) {
+    // AVX2 only has a signed 64-bit compare: flip the sign bit on both sides
+    const __m256i sign = _mm256_set1_epi64x(static_cast<long long>(1ULL << 63));
+    const __m256i k = _mm256_xor_si256(
+        _mm256_set1_epi64x(static_cast<long long>(key)), sign);
+    std::size_t cnt = 0, i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+        __m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(v, sign), k);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(gt));
+        cnt += 4 - static_cast<std::size_t>(__builtin_popcount(mask));
+    }
+    for (; i < n; ++i) cnt += keys[i] <= key;
+    return cnt;
+}
+
+__attribute__((target("avx512f")))
+std::size_t count_le_avx512(const std::uint64_t* keys, std::size_t n,
+                            std::uint64_t key) {
+    const __m512i k = _mm512_set1_epi64(static_cast<long long>(key));
+    std::size_t cnt = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __mmask8 m = _mm512_cmple_epu64_mask(_mm512_loadu_si512(keys + i), k);
+        cnt += static_cast<std::size_t>(__builtin_popcount(m));
+    }
+    if (i < n) {
+        __mmask8 tail = static_cast<__mmask8>((1u << (n - i)) - 1);
+        __mmask8 m = _mm512_mask_cmple_epu64_mask(
+            tail, _mm512_maskz_loadu_epi64(tail, keys + i), k);
+        cnt += static_cast<std::size_t>(__builtin_popcount(m));
+    }
+    return cnt;
+}
+#endif
+
+struct Kernel {
+    CountLeFn fn;
+    const char* name;
+};
+
+Kernel resolve_kernel() {
+    const char* forced = std::getenv("NODE_SEARCH_ISA");
+#ifdef SIMD_SEARCH_X86
+    __builtin_cpu_init();
+    bool has512 = __builtin_cpu_supports("avx512f");
+    bool has2   = __builtin_cpu_supports("avx2");
+    if (forced) {
+        if (std::strcmp(forced, "avx512") == 0 && has512) return {count_le_avx512, "avx512"};
+        if (std::strcmp(forced, "avx2") == 0 && has2) return {count_le_avx2, "avx2"};
+        if (std::strcmp(forced, "scalar") == 0) return {count_le_scalar, "scalar"};
+    }
+    if (has512) return {count_le_avx512, "avx512"};
+    if (has2) return {count_le_avx2, "avx2"};
+#else
+    (void)forced;
+#endif
+    return {count_le_scalar, "scalar"};
+}
+
+const Kernel kKernel = resolve_kernel();
+
+} // namespace
+
+const CountLeFn count_le = kKernel.fn;
+
+const char* count_le_isa() {
+    return kKernel.name;
+}
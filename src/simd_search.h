@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Number of entries in the sorted array keys[0, n) that are <= key.
+// Compares a broadcast key against blocks of keys and popcounts the mask;
+// the kernel (AVX-512, AVX2 or scalar) is picked once at startup from the
+// CPU, or forced through the NODE_SEARCH_ISA environment variable
+// ("avx512", "avx2", "scalar").
+using CountLeFn = std::size_t (*)(const std::uint64_t* keys, std::size_t n,
+                                  std::uint64_t key);
+extern const CountLeFn count_le;
+
+// Name of the kernel count_le dispatches to
+const char* count_le_isa();
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Minimal non-owning view over a contiguous array (std::span is C++20).
+// Converts implicitly from anything with data()/size(), e.g. std::vector.
+template <typename T>
+class Span {
+public:
+    Span() : data_(nullptr), size_(0) {}
+    Span(T* data, std::size_t size) : data_(data), size_(size) {}
+
+    template <typename Container,
+              typename = decltype(static_cast<T*>(std::declval<Container&>().data()))>
+    Span(Container& c) : data_(c.data()), size_(c.size()) {}
+
+    T* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    T& operator[](std::size_t i) const { return data_[i]; }
+    T& front() const { return data_[0]; }
+    T& back() const { return data_[size_ - 1]; }
+    T* begin() const { return data_; }
+    T* end() const { return data_ + size_; }
+
+    Span subspan(std::size_t offset, std::size_t count) const {
+        return Span(data_ + offset, count);
+    }
+
+private:
+    T* data_;
+    std::size_t size_;
+};
+
+// Sorted keys an index is built over; never copied by the indexes
+using KeySpan = Span<const std::uint64_t>;
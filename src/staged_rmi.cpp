@@ -0,0 +1,236 @@
+#include "staged_rmi.h"
+#include "last_mile.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// Model output -> index in [0, size)
+std::size_t clamp_index(double p, std::size_t size) {
+    if (!(p > 0.0)) return 0;
+    if (p >= static_cast<double>(size)) return size - 1;
+    return static_cast<std::size_t>(p);
+}
+
+} // namespace
+
+template <typename RootModel, typename Model>
+StagedRMI<RootModel, Model>::StagedRMI(std::vector<std::size_t> stage_sizes)
+    : sizes_(std::move(stage_sizes)), num_keys_(0), key_base_(0) {
+    if (sizes_.size() < 2 || sizes_[0] != 1) {
+        throw std::invalid_argument("StagedRMI: need a single root and at least one more stage");
+    }
+    for (std::size_t s : sizes_) {
+        if (s == 0 || s > 0xFFFFFFFFu) {
+            throw std::invalid_argument("StagedRMI: stage size must be in [1, 2^32)");
+        }
+    }
+}
+
+template <typename RootModel, typename Model>
+std::string StagedRMI<RootModel, Model>::stages_name() const {
+    std::string out;
+    for (std::size_t s : sizes_) {
+        if (!out.empty()) out += "x";
+        out += std::to_string(s);
+    }
+    return out;
+}
+
+template <typename RootModel, typename Model>
+void StagedRMI<RootModel, Model>::train(KeySpan keys, unsigned threads) {
+    if (keys.empty()) {
+        throw std::runtime_error("StagedRMI::train: empty keys");
+    }
+    keys_.reference(keys);
+    train_models(threads);
+}
+
+template <typename RootModel, typename Model>
+void StagedRMI<RootModel, Model>::train(std::vector<std::uint64_t>&& keys, unsigned threads) {
+    if (keys.empty()) {
+        throw std::runtime_error("StagedRMI::train: empty keys");
+    }
+    keys_.own(std::move(keys));
+    train_models(threads);
+}
+
+template <typename RootModel, typename Model>
+void StagedRMI<RootModel, Model>::attach(KeySpan keys) {
+    if (keys.size() != num_keys_ || (num_keys_ > 0 && keys[0] != key_base_)) {
+        throw std::invalid_argument("StagedRMI::attach: keys differ from the trained keys");
+    }
+    keys_.reference(keys);
+}
+
+// Stage by stage: the runs of a stage's models are found by binary search
+// over the routing of the stages above, which is monotone in the key.
+// Each model is then fitted over its run, and an inner model's child range
+// is set from the predictions for the first and last key of its run,
+// starting no lower than where the previous model's range ended.
+template <typename RootModel, typename Model>
+void StagedRMI<RootModel, Model>::train_models(unsigned threads) {
+    KeySpan keys = keys_.span();
+    std::size_t n = keys.size();
+    threads = resolve_threads(threads);
+    num_keys_ = n;
+    key_base_ = keys[0];
+    const std::size_t num_stages = sizes_.size();
+
+    root_ = RootModel();
+    root_.fit(keys, 0, key_base_, threads);
+    root_.scale(static_cast<double>(sizes_[1]) / static_cast<double>(n));
+    inner_.assign(num_stages - 2, std::vector<Inner>());
+    leaves_.clear();
+
+    // ends[j] = first index routed past model j of stage
+    auto run_ends = [&](std::size_t stage) {
+        std::vector<std::size_t> ends(sizes_[stage]);
+        parallel_for(sizes_[stage], threads, [&](std::size_t id) {
+            std::size_t lo = 0, hi = n;
+            while (lo < hi) {
+                std::size_t mid = (lo + hi) / 2;
+                if (route(keys[mid], stage) <= id) lo = mid + 1;
+                else hi = mid;
+            }
+            ends[id] = lo;
+        });
+        return ends;
+    };
+
+    for (std::size_t s = 1; s + 1 < num_stages; ++s) {
+        std::vector<std::size_t> ends = run_ends(s);
+        std::vector<Inner>& stage = inner_[s - 1];
+        stage.assign(sizes_[s], Inner{Model(), 0, 0});
+        std::size_t fanout = sizes_[s + 1];
+        double scale = static_cast<double>(fanout) / static_cast<double>(n);
+
+        parallel_for(sizes_[s], threads, [&](std::size_t j) {
+            std::size_t start = j == 0 ? 0 : ends[j - 1];
+            std::size_t end = ends[j];
+            if (end == start) return;
+            stage[j].model.fit(keys.subspan(start, end - start), start, key_base_, 1);
+            stage[j].model.scale(scale);
+        });
+
+        std::size_t prev_hi = 0;
+        for (std::size_t j = 0; j < sizes_[s]; ++j) {
+            std::size_t start = j == 0 ? 0 : ends[j - 1];
+            std::size_t end = ends[j];
+            std::size_t lo = prev_hi, hi = prev_hi;
+            if (end > start) {
+                const Model& m = stage[j].model;
+                lo = std::max(clamp_index(m.predict(shifted(keys[start])), fanout), prev_hi);
+                hi = std::max(clamp_index(m.predict(shifted(keys[end - 1])), fanout), lo);
+            }
+            stage[j].child_lo = static_cast<std::uint32_t>(lo);
+            stage[j].child_hi = static_cast<std::uint32_t>(hi);
+            prev_hi = hi;
+        }
+    }
+
+    std::size_t num_leaves = sizes_.back();
+    std::vector<std::size_t> ends = run_ends(num_stages - 1);
+    leaves_.assign(num_leaves, Leaf{Model(), 0, 0, 0, 0});
+    parallel_for(num_leaves, threads, [&](std::size_t j) {
+        std::size_t start = j == 0 ? 0 : ends[j - 1];
+        std::size_t end = ends[j];
+        Leaf& leaf = leaves_[j];
+        leaf.start_idx = start;
+        leaf.end_idx = end;
+        if (end == start) return;
+
+        leaf.model.fit(keys.subspan(start, end - start), start, key_base_, 1);
+        std::int64_t min_err = 0, max_err = 0;
+        for (std::size_t i = start; i < end; ++i) {
+            std::size_t pos = clamp_index(leaf.model.predict(shifted(keys[i])), n);
+            std::int64_t err = static_cast<std::int64_t>(i) - static_cast<std::int64_t>(pos);
+            if (i == start || err < min_err) min_err = err;
+            if (i == start || err > max_err) max_err = err;
+        }
+        leaf.min_error = min_err;
+        leaf.max_error = max_err;
+    });
+}
+
+template <typename RootModel, typename Model>
+std::size_t StagedRMI<RootModel, Model>::route(std::uint64_t key, std::size_t stage) const {
+    std::uint64_t x = shifted(key);
+    std::size_t id = clamp_index(root_.predict(x), sizes_[1]);
+    for (std::size_t s = 1; s < stage; ++s) {
+        const Inner& m = inner_[s - 1][id];
+        id = clamp_index(m.model.predict(x), sizes_[s + 1]);
+        id = std::min<std::size_t>(std::max<std::size_t>(id, m.child_lo), m.child_hi);
+    }
+    return id;
+}
+
+template <typename RootModel, typename Model>
+void StagedRMI<RootModel, Model>::leaf_window(std::uint64_t key, std::size_t& lo,
+                                              std::size_t& end) const {
+    const Leaf& leaf = leaves_[route(key, sizes_.size() - 1)];
+    std::size_t p = clamp_index(leaf.model.predict(shifted(key)), num_keys_);
+    error_window(p, leaf.min_error, leaf.max_error, leaf.start_idx, leaf.end_idx, lo, end);
+}
+
+template <typename RootModel, typename Model>
+bool StagedRMI<RootModel, Model>::search(std::uint64_t key, std::size_t& pos) const {
+    std::size_t p = lower_bound(key);
+    if (p == num_keys_ || keys_[p] != key) return false;
+    pos = p;
+    return true;
+}
+
+template <typename RootModel, typename Model>
+std::size_t StagedRMI<RootModel, Model>::lower_bound(std::uint64_t key) const {
+    if (num_keys_ == 0) return 0;
+    std::size_t lo = 0, end = 0;
+    leaf_window(key, lo, end);
+    return window_lower_bound(keys_.span(), key, lo, end);
+}
+
+template <typename RootModel, typename Model>
+MemoryUsage StagedRMI<RootModel, Model>::memory_usage() const {
+    MemoryUsage m;
+    m.index_bytes = sizeof(*this) + vector_heap_bytes(sizes_) + root_.heap_bytes() +
+                    vector_heap_bytes(inner_) + vector_heap_bytes(leaves_);
+    for (const std::vector<Inner>& stage : inner_) {
+        m.index_bytes += vector_heap_bytes(stage);
+        for (const Inner& in : stage) m.index_bytes += in.model.heap_bytes();
+    }
+    for (const Leaf& leaf : leaves_) m.index_bytes += leaf.model.heap_bytes();
+    m.data_bytes = keys_.owned() ? keys_.heap_bytes() : num_keys_ * sizeof(std::uint64_t);
+    return m;
+}
+
+template <typename RootModel, typename Model>
+double StagedRMI<RootModel, Model>::mean_log2_window() const {
+    if (num_keys_ == 0) return 0.0;
+    double sum = 0.0;
+    for (const Leaf& leaf : leaves_) {
+        std::size_t len = leaf.end_idx - leaf.start_idx;
+        if (len == 0) continue;
+        std::size_t w = window_size(leaf.min_error, leaf.max_error, len);
+        sum += static_cast<double>(len) * std::log2(static_cast<double>(w));
+    }
+    return sum / static_cast<double>(num_keys_);
+}
+
+template <typename RootModel, typename Model>
+std::vector<std::size_t> StagedRMI<RootModel, Model>::window_histogram() const {
+    std::vector<std::size_t> hist;
+    for (const Leaf& leaf : leaves_) {
+        std::size_t len = leaf.end_idx - leaf.start_idx;
+        if (len == 0) continue;
+        add_window(hist, window_size(leaf.min_error, leaf.max_error, len), len);
+    }
+    return hist;
+}
+
+template class StagedRMI<LinearModel, LinearModel>;
+template class StagedRMI<CubicModel, LinearModel>;
+template class StagedRMI<LogLinearModel, LinearModel>;
+template class StagedRMI<RadixRootModel, LinearModel>;
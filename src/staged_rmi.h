@@ -0,0 +1,93 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "key_array.h"
+#include "memory.h"
+#include "models.h"
+#include "span.h"
+
+// Recursive model index with any number of stages. stage_sizes gives the
+// number of models per stage: stage_sizes[0] must be 1 (the root), the
+// last entry is the number of leaf models, e.g. {1, 256, 65536}. Each
+// model predicts which model of the next stage to use; leaf models
+// predict a position with an error bound, as in BasicRMI.
+//
+// Models are trained top-down on the keys routed to them. Each inner
+// model stores the range of child ids it may route to, fixed at training
+// time so that routing stays monotone in the key: every model of every
+// stage then sees one contiguous run of the sorted keys, and training
+// needs no per-key buffers.
+template <typename RootModel, typename Model>
+class StagedRMI {
+public:
+    explicit StagedRMI(std::vector<std::size_t> stage_sizes);
+
+    static std::string model_name() {
+        return std::string(RootModel::name()) + "-" + Model::name();
+    }
+
+    // "1x256x65536"
+    std::string stages_name() const;
+    std::size_t num_stages() const { return sizes_.size(); }
+
+    // keys must be sorted; viewed or owned, and trained with threads, as
+    // in BasicRMI
+    void train(KeySpan keys, unsigned threads = 1);
+    void train(std::vector<std::uint64_t>&& keys, unsigned threads = 1);
+
+    // Point a trained index at another copy of its training keys; throws
+    // std::invalid_argument on a size or first-key mismatch
+    void attach(KeySpan keys);
+
+    KeySpan keys() const { return keys_.span(); }
+
+    bool search(std::uint64_t key, std::size_t& pos) const;
+
+    // Position of the first key >= key (number of keys if none)
+    std::size_t lower_bound(std::uint64_t key) const;
+
+    MemoryUsage memory_usage() const;
+
+    // Mean over the trained keys of log2 of their leaf's window size
+    double mean_log2_window() const;
+
+    // Window sizes of the trained keys in log2 buckets, as in BasicRMI
+    std::vector<std::size_t> window_histogram() const;
+
+private:
+    struct Inner {
+        Model model;
+        std::uint32_t child_lo;   // routing is clamped to [child_lo, child_hi]
+        std::uint32_t child_hi;
+    };
+    struct Leaf {
+        Model model;
+        std::size_t start_idx;
+        std::size_t end_idx;   // exclusive
+        std::int64_t min_error;   // signed, true - predicted position
+        std::int64_t max_error;
+    };
+
+    std::vector<std::size_t> sizes_;
+    KeyArray keys_;
+    std::size_t num_keys_;
+    std::uint64_t key_base_;
+    RootModel root_;
+    std::vector<std::vector<Inner>> inner_;   // stages 1 .. num_stages - 2
+    std::vector<Leaf> leaves_;
+
+    std::uint64_t shifted(std::uint64_t key) const {
+        return key > key_base_ ? key - key_base_ : 0;
+    }
+
+    // Id of the model in stage `stage` (>= 1) that key is routed to
+    std::size_t route(std::uint64_t key, std::size_t stage) const;
+
+    // Half-open window [lo, end) of the leaf for key
+    void leaf_window(std::uint64_t key, std::size_t& lo, std::size_t& end) const;
+
+    void train_models(unsigned threads);
+};
@@ -0,0 +1,31 @@
+#include "timing.h"
+
+#include <chrono>
+
+#ifndef TIMING_HAVE_TSC
+namespace {
+std::uint64_t steady_ns() {
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+} // namespace
+
+std::uint64_t tsc_begin() { return steady_ns(); }
+std::uint64_t tsc_end() { return steady_ns(); }
+#endif
+
+double tsc_ns_per_tick() {
+    static const double ns_per_tick = [] {
+        using clock = std::chrono::steady_clock;
+        // Busy-wait ~50 ms so frequency scaling settles on the measuring core
+        auto c0 = clock::now();
+        std::uint64_t t0 = tsc_begin();
+        auto c1 = c0;
+        while (c1 - c0 < std::chrono::milliseconds(50)) c1 = clock::now();
+        std::uint64_t t1 = tsc_end();
+        double ns = std::chrono::duration<double, std::nano>(c1 - c0).count();
+        return t1 > t0 ? ns / static_cast<double>(t1 - t0) : 1.0;
+    }();
+    return ns_per_tick;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TIMING_HAVE_TSC 1
+#endif
+
+// Cycle-counter timestamps for timing short stretches of code.
+// tsc_begin() waits for earlier instructions to finish before reading the
+// counter; tsc_end() waits for the timed code before reading and keeps
+// later instructions from starting early. Without a TSC both fall back to
+// steady_clock nanoseconds.
+#ifdef TIMING_HAVE_TSC
+inline std::uint64_t tsc_begin() {
+    _mm_lfence();
+    return __rdtsc();
+}
+
+inline std::uint64_t tsc_end() {
+    unsigned aux;
+    std::uint64_t t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+}
+#else
+std::uint64_t tsc_begin();
+std::uint64_t tsc_end();
+#endif
+
+// Nanoseconds per tick, calibrated once against steady_clock
+double tsc_ns_per_tick();
+
+// Keep the compiler from optimising away a value or hoisting work across it
+template <typename T>
+inline void do_not_optimize(T& value) {
+    asm volatile("" : "+r,m"(value) : : "memory");
+}
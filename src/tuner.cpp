@@ -0,0 +1,74 @@
+#include "tuner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+std::vector<RMICandidate> tune_rmi(KeySpan keys, const TunerOptions& opts) {
+    std::vector<RMICandidate> out;
+    std::size_t n = keys.size();
+    if (n == 0) return out;
+
+    // Every stride-th key: leaves see the same share of the key range as on
+    // the full set, and error windows scale up by about the stride
+    std::size_t stride = std::max<std::size_t>(1, (n + opts.sample_size - 1) / opts.sample_size);
+    std::vector<std::uint64_t> sample;
+    sample.reserve(n / stride + 1);
+    for (std::size_t i = 0; i < n; i += stride) sample.push_back(keys[i]);
+    double log2_stride = std::log2(static_cast<double>(stride));
+
+    for (std::size_t leaves : opts.leaf_counts) {
+        if (leaves == 0 || sample.size() / leaves < opts.min_sample_keys_per_leaf) continue;
+        for_each_rmi_type([&](auto* tag) {
+            using Index = std::remove_pointer_t<decltype(tag)>;
+            Index rmi(leaves);
+            rmi.train(sample, opts.threads);
+
+            RMICandidate c;
+            c.root_model = Index::root_model_name();
+            c.leaf_model = Index::leaf_model_name();
+            c.num_leaves = leaves;
+            c.model_bytes = rmi.memory_usage().index_bytes;
+            c.log2_window = rmi.mean_log2_window() + log2_stride;
+            double miss = 0.0;
+            if (c.model_bytes > opts.cache_bytes) {
+                miss = 1.0 - static_cast<double>(opts.cache_bytes) /
+                             static_cast<double>(c.model_bytes);
+            }
+            c.predicted_ns = opts.model_ns + opts.probe_ns * c.log2_window +
+                             opts.miss_ns * miss;
+            out.push_back(c);
+        });
+    }
+
+    // Pareto front over (model_bytes, predicted_ns): sorted by size, a
+    // candidate is on it if it is faster than everything smaller or equal
+    std::sort(out.begin(), out.end(), [](const RMICandidate& a, const RMICandidate& b) {
+        if (a.model_bytes != b.model_bytes) return a.model_bytes < b.model_bytes;
+        return a.predicted_ns < b.predicted_ns;
+    });
+    double best = INFINITY;
+    for (RMICandidate& c : out) {
+        if (c.predicted_ns < best) {
+            c.pareto = true;
+            best = c.predicted_ns;
+        }
+    }
+    return out;
+}
+
+const RMICandidate& pick_rmi(const std::vector<RMICandidate>& candidates,
+                             std::size_t budget_bytes) {
+    if (candidates.empty()) {
+        throw std::invalid_argument("pick_rmi: no candidates");
+    }
+    const RMICandidate* pick = nullptr;
+    for (const RMICandidate& c : candidates) {
+        if (!c.pareto || c.model_bytes > budget_bytes) continue;
+        if (!pick || c.predicted_ns < pick->predicted_ns) pick = &c;
+    }
+    if (pick) return *pick;
+    // Nothing fits: the smallest candidate
+    return *std::min_element(candidates.begin(), candidates.end(),
+        [](const RMICandidate& a, const RMICandidate& b) { return a.model_bytes < b.model_bytes; });
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "rmi.h"
+#include "span.h"
+
+// RMI configuration search in the spirit of CDFShop: every root x leaf
+// model combination is trained at several leaf counts on a sample of the
+// keys, and its lookup cost is estimated from the log2 of its error
+// windows and the size of its models.
+struct TunerOptions {
+    std::size_t sample_size = std::size_t(1) << 20;   // keys to train on
+    std::vector<std::size_t> leaf_counts = {
+        1 << 6, 1 << 8, 1 << 10, 1 << 12, 1 << 14, 1 << 16, 1 << 18};
+    // Leaf counts that leave fewer sample keys per leaf are skipped
+    std::size_t min_sample_keys_per_leaf = 4;
+    unsigned threads = 0;                              // 0 = all hardware threads
+
+    // Cost model:
+    //   predicted_ns = model_ns + probe_ns * log2(window)
+    //                + miss_ns * max(0, 1 - cache_bytes / model_bytes)
+    double model_ns = 8.0;       // root + leaf evaluation
+    double probe_ns = 6.0;       // one last-mile binary search step
+    double miss_ns  = 80.0;      // model lookups that miss the cache
+    std::size_t cache_bytes = std::size_t(1) << 20;
+};
+
+struct RMICandidate {
+    std::string root_model;
+    std::string leaf_model;
+    std::size_t num_leaves = 0;
+    std::size_t model_bytes = 0;
+    double log2_window = 0.0;    // estimated for the full key set
+    double predicted_ns = 0.0;
+    bool pareto = false;         // no other candidate is smaller and faster
+};
+
+// Estimate size and cost of every candidate configuration for keys
+std::vector<RMICandidate> tune_rmi(KeySpan keys, const TunerOptions& opts = TunerOptions());
+
+// Fastest predicted Pareto candidate whose models fit in budget_bytes, or
+// the smallest candidate if none fits
+const RMICandidate& pick_rmi(const std::vector<RMICandidate>& candidates,
+                             std::size_t budget_bytes);
+
+// Call fn(static_cast<BasicRMI<Root, Leaf>*>(nullptr)) for the combination
+// named by c; returns false if no instantiated combination matches
+template <typename Fn>
+bool visit_rmi_type(const RMICandidate& c, Fn fn) {
+    bool found = false;
+    for_each_rmi_type([&](auto* tag) {
+        using Index = std::remove_pointer_t<decltype(tag)>;
+        if (found || Index::root_model_name() != c.root_model ||
+            Index::leaf_model_name() != c.leaf_model) {
+            return;
+        }
+        found = true;
+        fn(tag);
+    });
+    return found;
+}